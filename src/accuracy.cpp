@@ -0,0 +1,202 @@
+// The SmartGaze Eye Tracker
+// Copyright (C) 2016  Tristan Hume
+// Released under GPLv2, see LICENSE file for full text
+
+// Runs trackFrame on synthetic frames with known pupils and reports how far off the tracked pupils
+// are along with how long each frame took, so speedups can be checked for lost accuracy.
+// SmartGazeAccuracy [frames] [--scene-seed n] [--json file] [--record file] plus tracking options.
+
+#include <opencv2/imgproc/imgproc.hpp>
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+#include "eyetracking.h"
+#include "instrument.h"
+#include "recording.h"
+#include "synthEye.h"
+
+using namespace cv;
+
+static const int kDefaultFrames = 600;
+// a tracked pupil further than this from the true one counts as a miss, about half a pupil
+static const float kMatchRadius = 12;
+
+struct ErrorStats {
+  std::vector<float> values;
+  void add(float v) { values.push_back(v); }
+  float mean() const {
+    double sum = 0;
+    for(float v : values) sum += v;
+    return values.empty() ? 0 : sum/values.size();
+  }
+  // p in [0,1], sorts in place
+  float percentile(float p) {
+    if(values.empty()) return 0;
+    std::sort(values.begin(), values.end());
+    return values[std::min(values.size()-1, (size_t)(p*values.size()))];
+  }
+};
+
+struct AccuracyReport {
+  int frames, eyes, found;
+  ErrorStats center, occludedCenter, majorAxis, minorAxis, glint, latencyMs;
+  AccuracyReport() : frames(0), eyes(0), found(0) {}
+};
+
+static float distance(Point2f a, Point2f b) {
+  Point2f d = a - b;
+  return sqrtf(d.x*d.x + d.y*d.y);
+}
+
+static void scoreFrame(AccuracyReport &report, const SyntheticScene &scene, const TrackingResult &result) {
+  for(const SyntheticEye &truth : scene.eyes) {
+    report.eyes++;
+    const EyeResult *best = nullptr;
+    float bestDist = kMatchRadius;
+    for(unsigned i = 0; i < result.numEyes; ++i) {
+      const EyeResult &eye = result.eyes[i];
+      if(eye.confidence <= 0) continue;
+      float d = distance(Point2f(eye.pupilX, eye.pupilY), truth.pupil.center);
+      if(d < bestDist) {
+        bestDist = d;
+        best = &eye;
+      }
+    }
+    if(!best) continue;
+    report.found++;
+    report.center.add(bestDist);
+    if(truth.pupilOccluded) report.occludedCenter.add(bestDist);
+    float trueMajor = std::max(truth.pupil.size.width, truth.pupil.size.height);
+    float trueMinor = std::min(truth.pupil.size.width, truth.pupil.size.height);
+    report.majorAxis.add(fabsf(std::max(best->pupilWidth, best->pupilHeight) - trueMajor));
+    report.minorAxis.add(fabsf(std::min(best->pupilWidth, best->pupilHeight) - trueMinor));
+    report.glint.add(distance(Point2f(best->glintX, best->glintY), (truth.glints[0] + truth.glints[1])*0.5f));
+  }
+}
+
+static void printStats(const char *name, ErrorStats &s, const char *unit) {
+  printf("%-22s mean %6.2f  median %6.2f  p95 %6.2f  max %6.2f %s\n", name, s.mean(), s.percentile(0.5f),
+         s.percentile(0.95f), s.percentile(1.0f), unit);
+}
+
+static void writeStats(FILE *f, const char *name, ErrorStats &s, bool last) {
+  fprintf(f, "  \"%s\": {\"count\": %d, \"mean\": %.4f, \"median\": %.4f, \"p95\": %.4f, \"max\": %.4f}%s\n", name,
+          (int)s.values.size(), s.mean(), s.percentile(0.5f), s.percentile(0.95f), s.percentile(1.0f), last ? "" : ",");
+}
+
+static bool writeJSON(const char *path, AccuracyReport &r) {
+  FILE *f = fopen(path, "w");
+  if(!f) {
+    perror("SmartGazeAccuracy json");
+    return false;
+  }
+  fprintf(f, "{\n  \"frames\": %d,\n  \"eyes\": %d,\n  \"found\": %d,\n", r.frames, r.eyes, r.found);
+  writeStats(f, "center_error_px", r.center, false);
+  writeStats(f, "occluded_center_error_px", r.occludedCenter, false);
+  writeStats(f, "major_axis_error_px", r.majorAxis, false);
+  writeStats(f, "minor_axis_error_px", r.minorAxis, false);
+  writeStats(f, "glint_error_px", r.glint, false);
+  writeStats(f, "latency_ms", r.latencyMs, true);
+  fprintf(f, "}\n");
+  fclose(f);
+  return true;
+}
+
+static void usage(const char *prog) {
+  fprintf(stderr, "usage: %s [frames] [--scene-seed n] [--json file] [--record file] [--defect x,y]... [--full-glint-scan] [--inpaint] [--ransac-float] [--seed n]\n", prog);
+  fprintf(stderr, "  --scene-seed n picks the synthetic scene, the same seed always renders the same frames\n");
+  fprintf(stderr, "  --json file    also write the report as JSON\n");
+  fprintf(stderr, "  --record file  save the rendered frames as a recording for SmartGaze --replay\n");
+  fprintf(stderr, "  the other options are the same as SmartGaze's\n");
+}
+
+int main(int argc, char **argv) {
+  int numFrames = kDefaultFrames;
+  unsigned sceneSeed = 1;
+  const char *jsonPath = nullptr;
+  const char *recordPath = nullptr;
+  TrackingOptions opts;
+  opts.debugView = false;
+  for(int i = 1; i < argc; ++i) {
+    if(strcmp(argv[i], "--scene-seed") == 0 && i+1 < argc) {
+      sceneSeed = strtoul(argv[++i], nullptr, 10);
+    } else if(strcmp(argv[i], "--json") == 0 && i+1 < argc) {
+      jsonPath = argv[++i];
+    } else if(strcmp(argv[i], "--record") == 0 && i+1 < argc) {
+      recordPath = argv[++i];
+    } else if(strcmp(argv[i], "--defect") == 0 && i+1 < argc) {
+      Point p;
+      if(sscanf(argv[++i], "%d,%d", &p.x, &p.y) != 2) {
+        usage(argv[0]);
+        return 1;
+      }
+      opts.defectivePixels.push_back(p);
+    } else if(strcmp(argv[i], "--full-glint-scan") == 0) {
+      opts.temporalGlints = false;
+    } else if(strcmp(argv[i], "--inpaint") == 0) {
+      opts.inpaintGlints = true;
+    } else if(strcmp(argv[i], "--ransac-float") == 0) {
+      opts.ransacSinglePrecision = true;
+    } else if(strcmp(argv[i], "--seed") == 0 && i+1 < argc) {
+      opts.ransacSeed = strtoul(argv[++i], nullptr, 10);
+    } else if(argv[i][0] != '-') {
+      numFrames = atoi(argv[i]);
+    } else {
+      usage(argv[0]);
+      return 1;
+    }
+  }
+
+  FrameRecorder *recorder = nullptr;
+  if(recordPath) {
+    recorder = createRecorder(recordPath, kCaptureWidth, kCaptureHeight);
+    if(recorder == nullptr) return 1;
+  }
+
+  TrackingData *tracking = setupTracking(opts);
+  SyntheticScene scene(sceneSeed);
+  AccuracyReport report;
+  Mat frame;
+  for(int n = 0; n < numFrames; ++n) {
+    renderSyntheticFrame(scene, frame);
+    int64_t timestampUs = (int64_t)n*1000000/kCaptureFPS;
+    if(recorder) {
+      Frame f;
+      f.data = frame.ptr<uint16_t>();
+      f.width = frame.cols;
+      f.height = frame.rows;
+      f.timestampUs = timestampUs;
+      f.sequence = n;
+      f.capturedUs = 0;
+      recordFrame(recorder, f);
+    }
+
+    // trackFrame may write over the frame, and it isn't needed again
+    auto start = std::chrono::steady_clock::now();
+    TrackingResult result = trackFrame(tracking, frame, n, timestampUs);
+    auto end = std::chrono::steady_clock::now();
+    report.latencyMs.add(std::chrono::duration_cast<std::chrono::microseconds>(end-start).count() / 1000.0f);
+    report.frames++;
+    scoreFrame(report, scene, result);
+  }
+  deleteTracking(tracking);
+  if(recorder) closeRecorder(recorder);
+
+  printf("%d frames, pupils found within %.0fpx for %d of %d eyes (%.1f%%)\n", report.frames, kMatchRadius,
+         report.found, report.eyes, report.eyes ? 100.0*report.found/report.eyes : 0.0);
+  printStats("pupil center error", report.center, "px");
+  printStats("  under a lid", report.occludedCenter, "px");
+  printStats("major axis error", report.majorAxis, "px");
+  printStats("minor axis error", report.minorAxis, "px");
+  printStats("glint error", report.glint, "px");
+  printStats("latency", report.latencyMs, "ms");
+  printStageReport(stdout);
+  if(jsonPath && !writeJSON(jsonPath, report)) return 1;
+  return 0;
+}
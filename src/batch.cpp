@@ -0,0 +1,251 @@
+// The SmartGaze Eye Tracker
+// Copyright (C) 2016  Tristan Hume
+// Released under GPLv2, see LICENSE file for full text
+
+// Tracks every frame of a recording as fast as the machine allows by spreading frames over all cores,
+// then writes the results in frame order to a columnar file.
+// SmartGazeBatch recording output [--jobs n] [--chunk frames] [--warmup frames] plus tracking options.
+//
+// Tracking carries state between frames (glint positions, the RANSAC sample streams), so frames
+// can't just be dealt out one at a time. Instead the recording is cut into chunks that are tracked
+// independently, each by one worker starting from a reset tracker. With temporal glint tracking
+// each chunk first tracks some frames before its start and throws their results away, so it
+// starts with the glints already locked on like a straight run would be. Results depend on the
+// chunk and warm-up sizes but not on how many workers there are.
+//
+// The output is a ColumnarHeader, numColumns ColumnDescriptors, then each column's rows back to
+// back at its offset. Eyes past a frame's num_eyes are all 0. With numpy a column is
+//   np.frombuffer(data, dtype=descriptor.dtype, count=header.rows, offset=descriptor.offset)
+
+#include <opencv2/imgproc/imgproc.hpp>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "eyetracking.h"
+#include "instrument.h"
+#include "recording.h"
+
+using namespace cv;
+
+static const int kDefaultChunkFrames = 30*kCaptureFPS;
+static const int kDefaultWarmupFrames = kCaptureFPS; // glint tracking locks on within a few frames
+
+static const char kColumnarMagic[4] = {'S','G','C','L'};
+static const uint32_t kColumnarVersion = 1;
+
+struct ColumnarHeader {
+  char magic[4];
+  uint32_t version;
+  uint64_t rows;
+  uint32_t numColumns;
+  uint32_t reserved;
+};
+
+struct ColumnDescriptor {
+  char name[32];
+  char dtype[8];   // numpy style, like <f4
+  uint64_t offset; // from the start of the file
+};
+
+struct Column {
+  std::string name;
+  const char *dtype;
+  size_t offset, size; // of the field in TrackingResult
+};
+
+static std::vector<Column> resultColumns() {
+  std::vector<Column> cols;
+  cols.push_back({"sequence", "<u8", offsetof(TrackingResult, sequence), sizeof(uint64_t)});
+  cols.push_back({"capture_time_us", "<i8", offsetof(TrackingResult, captureTimeUs), sizeof(int64_t)});
+  cols.push_back({"num_eyes", "<u4", offsetof(TrackingResult, numEyes), sizeof(uint32_t)});
+  static const struct { const char *name; size_t offset; } eyeFields[] = {
+    {"glint_x", offsetof(EyeResult, glintX)}, {"glint_y", offsetof(EyeResult, glintY)},
+    {"pupil_x", offsetof(EyeResult, pupilX)}, {"pupil_y", offsetof(EyeResult, pupilY)},
+    {"pupil_width", offsetof(EyeResult, pupilWidth)}, {"pupil_height", offsetof(EyeResult, pupilHeight)},
+    {"pupil_angle", offsetof(EyeResult, pupilAngle)}, {"confidence", offsetof(EyeResult, confidence)},
+  };
+  for(int e = 0; e < kMaxTrackedEyes; ++e) {
+    for(const auto &field : eyeFields) {
+      cols.push_back({"eye" + std::to_string(e) + "_" + field.name, "<f4",
+                      offsetof(TrackingResult, eyes) + e*sizeof(EyeResult) + field.offset, sizeof(float)});
+    }
+  }
+  return cols;
+}
+
+static bool writeColumnar(const char *path, const std::vector<TrackingResult> &results) {
+  FILE *f = fopen(path, "wb");
+  if(!f) {
+    perror("SmartGazeBatch output");
+    return false;
+  }
+  std::vector<Column> cols = resultColumns();
+  ColumnarHeader header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, kColumnarMagic, sizeof(header.magic));
+  header.version = kColumnarVersion;
+  header.rows = results.size();
+  header.numColumns = cols.size();
+  fwrite(&header, sizeof(header), 1, f);
+
+  uint64_t offset = sizeof(header) + cols.size()*sizeof(ColumnDescriptor);
+  for(const Column &c : cols) {
+    ColumnDescriptor desc;
+    memset(&desc, 0, sizeof(desc));
+    strncpy(desc.name, c.name.c_str(), sizeof(desc.name)-1);
+    strncpy(desc.dtype, c.dtype, sizeof(desc.dtype)-1);
+    desc.offset = offset;
+    fwrite(&desc, sizeof(desc), 1, f);
+    offset += c.size*results.size();
+  }
+
+  std::vector<uint8_t> data;
+  for(const Column &c : cols) {
+    data.resize(c.size*results.size());
+    for(size_t i = 0; i < results.size(); ++i)
+      memcpy(&data[i*c.size], (const uint8_t*)(&results[i]) + c.offset, c.size);
+    fwrite(data.data(), 1, data.size(), f);
+  }
+  bool ok = !ferror(f);
+  if(fclose(f) != 0) ok = false;
+  if(!ok) fprintf(stderr, "Error! couldn't write %s\n", path);
+  return ok;
+}
+
+struct BatchJob {
+  RecordingReader *reader;
+  TrackingOptions opts;
+  size_t numFrames, chunkFrames, warmupFrames;
+  std::vector<TrackingResult> results; // indexed by frame, each written by exactly one worker
+  std::atomic<size_t> nextChunk{0};
+  std::atomic<size_t> framesDone{0};
+};
+
+static void batchWorker(BatchJob *job) {
+  // each worker has its own tracking context, so its own Halide pipelines, buffers and RANSAC streams
+  TrackingData *tracking = setupTracking(job->opts);
+  // Frames are copied out of the mapping rather than tracked in place, since chunks overlap during
+  // warm-up and tracking patches defective pixels in its input.
+  Mat frame(kCaptureHeight, kCaptureWidth, CV_16UC1);
+  size_t numChunks = (job->numFrames + job->chunkFrames - 1)/job->chunkFrames;
+  for(size_t c = job->nextChunk++; c < numChunks; c = job->nextChunk++) {
+    size_t start = c*job->chunkFrames;
+    size_t end = std::min(start + job->chunkFrames, job->numFrames);
+    resetTracking(tracking);
+    for(size_t i = start - std::min(start, job->warmupFrames); i < end; ++i) {
+      Frame f = recordedFrame(job->reader, i);
+      Mat(f.height, f.width, CV_16UC1, f.data).copyTo(frame);
+      TrackingResult result = trackFrame(tracking, frame, f.sequence, f.timestampUs);
+      if(i >= start) job->results[i] = result;
+    }
+    job->framesDone += end - start;
+  }
+  deleteTracking(tracking);
+}
+
+static void usage(const char *prog) {
+  fprintf(stderr, "usage: %s recording output [--jobs n] [--chunk frames] [--warmup frames] [--defect x,y]... [--full-glint-scan] [--inpaint] [--ransac-float] [--seed n]\n", prog);
+  fprintf(stderr, "  --jobs n       frames tracked at once, default every core\n");
+  fprintf(stderr, "  --chunk frames frames each worker tracks in a row, default %d\n", kDefaultChunkFrames);
+  fprintf(stderr, "  --warmup frames  frames tracked before each chunk to settle temporal tracking, default %d, unused with --full-glint-scan\n", kDefaultWarmupFrames);
+  fprintf(stderr, "  the other options are the same as SmartGaze's\n");
+}
+
+int main(int argc, char **argv) {
+  const char *inputPath = nullptr;
+  const char *outputPath = nullptr;
+  int jobs = 0;
+  int chunkFrames = kDefaultChunkFrames;
+  int warmupFrames = kDefaultWarmupFrames;
+  TrackingOptions opts;
+  opts.debugView = false;
+  // frames are already spread over every core, splitting each one up as well would only add overhead
+  opts.threads = 1;
+  for(int i = 1; i < argc; ++i) {
+    if(strcmp(argv[i], "--jobs") == 0 && i+1 < argc) {
+      jobs = atoi(argv[++i]);
+    } else if(strcmp(argv[i], "--chunk") == 0 && i+1 < argc) {
+      chunkFrames = atoi(argv[++i]);
+    } else if(strcmp(argv[i], "--warmup") == 0 && i+1 < argc) {
+      warmupFrames = atoi(argv[++i]);
+    } else if(strcmp(argv[i], "--defect") == 0 && i+1 < argc) {
+      Point p;
+      if(sscanf(argv[++i], "%d,%d", &p.x, &p.y) != 2) {
+        usage(argv[0]);
+        return 1;
+      }
+      opts.defectivePixels.push_back(p);
+    } else if(strcmp(argv[i], "--full-glint-scan") == 0) {
+      opts.temporalGlints = false;
+    } else if(strcmp(argv[i], "--inpaint") == 0) {
+      opts.inpaintGlints = true;
+    } else if(strcmp(argv[i], "--ransac-float") == 0) {
+      opts.ransacSinglePrecision = true;
+    } else if(strcmp(argv[i], "--seed") == 0 && i+1 < argc) {
+      opts.ransacSeed = strtoul(argv[++i], nullptr, 10);
+    } else if(argv[i][0] != '-' && !inputPath) {
+      inputPath = argv[i];
+    } else if(argv[i][0] != '-' && !outputPath) {
+      outputPath = argv[i];
+    } else {
+      usage(argv[0]);
+      return 1;
+    }
+  }
+  if(!inputPath || !outputPath || chunkFrames <= 0 || warmupFrames < 0) {
+    usage(argv[0]);
+    return 1;
+  }
+  if(jobs <= 0) jobs = std::max(1u, std::thread::hardware_concurrency());
+  // Halide runs its parallel loops on one shared pool, which would compete with the workers
+  setenv("HL_NUM_THREADS", "1", 0);
+
+  RecordingReader *reader = openRecording(inputPath);
+  // readers are only opened on recordings with at least one frame
+  if(reader == nullptr) return 1;
+  Frame first = recordedFrame(reader, 0);
+  if(first.width != kCaptureWidth || first.height != kCaptureHeight) {
+    fprintf(stderr, "Error! %s is %ix%i, tracking needs %ix%i frames\n", inputPath, first.width, first.height,
+            kCaptureWidth, kCaptureHeight);
+    closeRecording(reader);
+    return 1;
+  }
+
+  BatchJob job;
+  job.reader = reader;
+  job.opts = opts;
+  job.numFrames = recordingFrameCount(reader);
+  job.chunkFrames = chunkFrames;
+  // without temporal glints nothing that matters carries over between frames
+  job.warmupFrames = opts.temporalGlints ? warmupFrames : 0;
+  job.results.resize(job.numFrames);
+  printf("Tracking %zu frames from %s with %d jobs\n", job.numFrames, inputPath, jobs);
+
+  auto start = std::chrono::steady_clock::now();
+  std::vector<std::thread> workers;
+  for(int i = 0; i < jobs; ++i) workers.push_back(std::thread(batchWorker, &job));
+  while(job.framesDone < job.numFrames) {
+    std::this_thread::sleep_for(std::chrono::seconds(1));
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now()-start).count();
+    size_t done = job.framesDone;
+    printf("\r%zu/%zu frames (%.1f fps)", done, job.numFrames, done/elapsed);
+    fflush(stdout);
+  }
+  for(std::thread &t : workers) t.join();
+  double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now()-start).count();
+  printf("\nTracked %zu frames in %.3fs (%.1f fps)\n", job.numFrames, elapsed, job.numFrames/elapsed);
+  closeRecording(reader);
+
+  printStageReport(stdout);
+  if(!writeColumnar(outputPath, job.results)) return 1;
+  printf("Wrote %s\n", outputPath);
+  return 0;
+}
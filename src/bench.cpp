@@ -0,0 +1,341 @@
+// The SmartGaze Eye Tracker
+// Copyright (C) 2016  Tristan Hume
+// Released under GPLv2, see LICENSE file for full text
+
+// Microbenchmarks for each tracking stage on fixed synthetic input,
+// run with SmartGazeBench [iterations] [--json file]
+
+#include <opencv2/imgproc/imgproc.hpp>
+#include <opencv2/photo/photo.hpp>
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <iostream>
+#include <random>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+#include "glintFill.h"
+#include "ellipse.h"
+#include "glints.h"
+#include "frameSource.h"
+#include "halideFuncs.h"
+#include "rayCast.h"
+#include "starburst.h"
+#include "threadPool.h"
+
+using namespace cv;
+
+static const int kDefaultIterations = 200;
+// iterations are timed in this many rounds so the spread between rounds shows up in the results
+static const int kRounds = 10;
+// the same 16 to 8 bit scale trackFrame converts eye regions with
+static const double k8BitScale = (265.0/1024.0)*2.0;
+// how far the single precision RANSAC fit may stray from the double one before the bench fails,
+// in inliers and in pixels or radians of the ellipse parameters
+static const int kMaxInlierDifference = 2;
+static const double kMaxParamDifference = 0.5;
+
+struct BenchResult {
+  std::string name;
+  int calls;
+  double meanUs, minUs, medianUs, maxUs; // per call, the min, median and max are over rounds
+};
+static std::vector<BenchResult> results;
+
+static void benchmark(const char *name, int iters, const std::function<void()> &fn) {
+  fn(); // warm up caches and lazily sized buffers
+  int perRound = std::max(1, iters/kRounds);
+  std::vector<double> rounds;
+  double totalUs = 0;
+  for(int r = 0; r < kRounds; ++r) {
+    auto start = std::chrono::steady_clock::now();
+    for(int i = 0; i < perRound; ++i) fn();
+    auto end = std::chrono::steady_clock::now();
+    double us = std::chrono::duration_cast<std::chrono::nanoseconds>(end-start).count() / 1000.0;
+    totalUs += us;
+    rounds.push_back(us/perRound);
+  }
+  std::sort(rounds.begin(), rounds.end());
+
+  BenchResult res;
+  res.name = name;
+  res.calls = perRound*kRounds;
+  res.meanUs = totalUs/res.calls;
+  res.minUs = rounds.front();
+  res.medianUs = rounds[kRounds/2];
+  res.maxUs = rounds.back();
+  results.push_back(res);
+  std::cout << name << ": " << res.meanUs << "us per call (min " << res.minUs << ", max " << res.maxUs << ")\n";
+}
+
+// names are plain ASCII without quotes, so they go into the JSON as is
+static bool writeJSON(const char *path, int iters, int threads) {
+  FILE *f = fopen(path, "w");
+  if(!f) {
+    perror("SmartGazeBench json");
+    return false;
+  }
+  fprintf(f, "{\n  \"iterations\": %d,\n  \"rounds\": %d,\n  \"threads\": %d,\n  \"benchmarks\": [\n", iters, kRounds, threads);
+  for(size_t i = 0; i < results.size(); ++i) {
+    const BenchResult &r = results[i];
+    fprintf(f, "    {\"name\": \"%s\", \"calls\": %d, \"mean_us\": %.4f, \"min_us\": %.4f, \"median_us\": %.4f, \"max_us\": %.4f}%s\n",
+            r.name.c_str(), r.calls, r.meanUs, r.minUs, r.medianUs, r.maxUs, i+1 < results.size() ? "," : "");
+  }
+  fprintf(f, "  ]\n}\n");
+  fclose(f);
+  return true;
+}
+
+// A full resolution 10 bit frame: a face with two dark pupils inside darker irises,
+// each with its pair of glints below the pupil like the Eye Tribe's lights make.
+static void makeFullFrame(Mat &frame) {
+  frame.create(kCaptureHeight, kCaptureWidth, CV_16UC1);
+  const Point eyes[2] = {Point(520, 560), Point(1010, 566)};
+  for(int i = 0; i < frame.rows; i++) {
+    uint16_t *Fi = frame.ptr<uint16_t>(i);
+    for(int j = 0; j < frame.cols; j++) {
+      uint16_t v = 420 + (j+i)/16;
+      for(const Point &e : eyes) {
+        int dx = j-e.x, dy = i-e.y;
+        int r2 = dx*dx + dy*dy;
+        if(r2 < 21*21) v = 70;
+        else if(r2 < 46*46) v = 260;
+      }
+      Fi[j] = v;
+    }
+  }
+  for(const Point &e : eyes) {
+    for(int side = -1; side <= 1; side += 2) {
+      Rect glint(e.x + side*9 - 2, e.y + 12, 5, 5);
+      frame(glint) = Scalar(1023);
+    }
+  }
+}
+
+// Worst case for the full glint scan: the dark upper half is covered in specular
+// highlights off hair that all fail the intensity check, and the real glints are
+// near the bottom of a bright face so the scan has to get through every decoy first.
+static void makeHairyFrame(Mat &mask, Mat &gray) {
+  const int width = 768, height = 512;
+  gray.create(height, width, CV_8UC1);
+  mask.create(height, width, CV_8UC1);
+  for(int i = 0; i < height; i++) {
+    uint8_t *Gi = gray.ptr<uint8_t>(i);
+    uint8_t *Mi = mask.ptr<uint8_t>(i);
+    for(int j = 0; j < width; j++) {
+      Gi[j] = (i < height/2) ? 15 : 120;
+      Mi[j] = 255;
+    }
+  }
+  // hair highlights, one every few pixels across the dark region
+  for(int i = 20; i < height/2; i += 6)
+    for(int j = (i/6 % 2)*3; j < width; j += 6)
+      mask.at<uint8_t>(i,j) = 0;
+  // two glints on the bright lower half
+  for(int dy = 0; dy < 3; dy++) {
+    for(int dx = 0; dx < 3; dx++) {
+      mask.at<uint8_t>(400+dy, 250+dx) = 0;
+      mask.at<uint8_t>(402+dy, 520+dx) = 0;
+    }
+  }
+}
+
+// an eye region with a dark pupil and two glints on its edge, plus the half size glint mask crop
+static void makeEyeRegion(Mat &region, Mat &mask) {
+  const int width = 200, height = 160;
+  region.create(height, width, CV_8UC1);
+  mask.create(height/2, width/2, CV_8UC1);
+  for(int i = 0; i < height; i++) {
+    uint8_t *Ri = region.ptr<uint8_t>(i);
+    for(int j = 0; j < width; j++) {
+      int dx = j-width/2, dy = i-height/2;
+      Ri[j] = (dx*dx + dy*dy < 30*30) ? 20 : 90 + j/4;
+    }
+  }
+  for(int i = 0; i < mask.rows; i++)
+    for(int j = 0; j < mask.cols; j++)
+      mask.at<uint8_t>(i,j) = 255;
+  for(int dy = 0; dy < 3; dy++) {
+    for(int dx = 0; dx < 3; dx++) {
+      mask.at<uint8_t>(32+dy, 40+dx) = 0;
+      mask.at<uint8_t>(32+dy, 56+dx) = 0;
+      region.at<uint8_t>(64+dy*2, 80+dx*2) = 255;
+      region.at<uint8_t>(64+dy*2, 112+dx*2) = 255;
+    }
+  }
+}
+
+// starburst style edge points: most on a pupil ellipse with a little jitter, the rest scattered outliers
+static void makeEdgePoints(std::vector<Point2f> &points) {
+  std::minstd_rand rng(1234);
+  std::uniform_real_distribution<float> jitter(-0.7f, 0.7f);
+  std::uniform_real_distribution<float> anywhere(20.0f, 180.0f);
+  const float cx = 100, cy = 80, a = 30, b = 24, theta = 0.3f;
+  for(int i = 0; i < 160; i++) {
+    float t = i*(2*3.14159265f/160);
+    float x = a*std::cos(t), y = b*std::sin(t);
+    points.push_back(Point2f(cx + x*std::cos(theta) - y*std::sin(theta) + jitter(rng),
+                             cy + x*std::sin(theta) + y*std::cos(theta) + jitter(rng)));
+  }
+  for(int i = 0; i < 40; i++)
+    points.push_back(Point2f(anywhere(rng), anywhere(rng)*0.8f));
+}
+
+int main(int argc, char **argv) {
+  int iters = kDefaultIterations;
+  const char *jsonPath = nullptr;
+  for(int i = 1; i < argc; ++i) {
+    if(strcmp(argv[i], "--json") == 0 && i+1 < argc) {
+      jsonPath = argv[++i];
+    } else {
+      iters = atoi(argv[i]);
+    }
+  }
+
+  bool failed = false; // a correctness check failed, the timings still get written
+  Mat frame, half, frameMask;
+  makeFullFrame(frame);
+  HalideGens *gens = createGens();
+  benchmark("front end, downscale and glint mask", iters, [&]() {
+    frontEnd(gens, frame, half, frameMask);
+  });
+  GlintTracker frameTracker;
+  frameTracker.temporal = false;
+  std::cout << "found " << trackGlints(frameTracker, frameMask, half).size() << " glints in the full frame\n";
+  Mat eyeRaw(frame, Rect(520-100, 560-80, 200, 160));
+  benchmark("eye region convert and blur", iters, [&]() {
+    Mat region;
+    eyeRaw.convertTo(region, CV_8U, k8BitScale, 0);
+    blur(region, region, Size(3,3));
+  });
+
+  Mat mask, gray;
+  makeHairyFrame(mask, gray);
+  GlintTracker tracker;
+  tracker.temporal = false;
+  auto glints = trackGlints(tracker, mask, gray);
+  std::cout << "found " << glints.size() << " glints\n";
+  benchmark("glint full scan, hairy frame", iters, [&]() {
+    trackGlints(tracker, mask, gray);
+  });
+  GlintIntegrals integrals;
+  integrals.reset(gray);
+  benchmark("glint intensity integral, whole frame", iters, [&]() {
+    integrals.reset(gray);
+    integrals.integrateIntensity(gray.rows);
+  });
+  benchmark("glint local intensity, 64 points", iters, [&]() {
+    for(int k = 0; k < 64; ++k) findLocalIntensity(integrals, Point(40 + k*11, 100 + k*6), 20);
+  });
+
+  Mat eye, eyeMask;
+  makeEyeRegion(eye, eyeMask);
+  GlintFillBuffers fillBuffers;
+  benchmark("glint fill, eye region", iters, [&]() {
+    Mat region = eye.clone();
+    fillGlints(region, eyeMask, fillBuffers);
+  });
+  benchmark("glint mask and inpaint, eye region", iters, [&]() {
+    Mat region = eye.clone();
+    Mat inpaintMask;
+    threshold(eyeMask, inpaintMask, 0, 255, THRESH_BINARY_INV);
+    dilate(inpaintMask, inpaintMask, getStructuringElement(MORPH_RECT, Size(4,4)));
+    resize(inpaintMask, inpaintMask, region.size());
+    inpaint(region, inpaintMask, region, 4, INPAINT_NS);
+  });
+
+  Mat validMask;
+  Point seed = findStarburstSeed(eye, validMask);
+  std::cout << "starburst seed " << seed << "\n";
+  benchmark("starburst seed, blur and minMaxLoc", iters, [&]() {
+    findStarburstSeed(eye, validMask);
+  });
+  StarburstContext edgeCtx;
+  benchmark("starburst edge points", iters, [&]() {
+    starburst_pupil_contour_detection(edgeCtx, eye, validMask, seed, starThresh, starRays, 1);
+  });
+  std::cout << "starburst found " << edgeCtx.edges.pos.size() << " edge points\n";
+
+  Mat everywhere(eye.rows, eye.cols, CV_8UC1, Scalar(255));
+  RayCaster caster;
+  caster.setImage(eye, everywhere);
+  EdgePoints edges;
+  benchmark("starburst ray cast, 45 rays", iters, [&]() {
+    edges.clear();
+    int seed = edges.addSeed(Point2f(eye.cols/2, eye.rows/2));
+    caster.cast(edges, seed, 7, 2*3.14159265/45, 0, 2*3.14159265, 16);
+  });
+
+  EllipseScoreBuffers scoreBuffers;
+  RotatedRect pupil(Point2f(eye.cols/2, eye.rows/2), Size2f(60, 60), 0);
+  std::cout << "pupil ellipse score " << ellipseScore(eye, pupil, scoreBuffers) << "\n";
+  benchmark("ellipse contour score", iters, [&]() {
+    ellipseScore(eye, pupil, scoreBuffers);
+  });
+
+  // both precisions start from the same random stream so they draw the same samples
+  StarburstContext doubleCtx, floatCtx;
+  makeEdgePoints(doubleCtx.edges.pos);
+  floatCtx.edges.pos = doubleCtx.edges.pos;
+  floatCtx.single_precision = true;
+  int doubleInliers, floatInliers;
+  free(pupil_fitting_inliers(doubleCtx, 200, 160, doubleInliers));
+  free(pupil_fitting_inliers(floatCtx, 200, 160, floatInliers));
+  double maxDiff = 0;
+  for(int i = 0; i < 5; i++)
+    maxDiff = std::max(maxDiff, std::abs(doubleCtx.pupil_param[i] - floatCtx.pupil_param[i]));
+  // points right on the inlier threshold may count differently, anything more is a precision bug
+  bool precisionOk = std::abs(doubleInliers - floatInliers) <= kMaxInlierDifference && maxDiff <= kMaxParamDifference;
+  std::cout << "ransac inliers double: " << doubleInliers << " float: " << floatInliers
+            << ", max ellipse parameter difference " << maxDiff << (precisionOk ? "" : ", TOO FAR APART") << "\n";
+  if(!precisionOk) failed = true;
+  benchmark("ransac ellipse fit, double", iters, [&]() {
+    int inliers;
+    free(pupil_fitting_inliers(doubleCtx, 200, 160, inliers));
+  });
+  benchmark("ransac ellipse fit, float", iters, [&]() {
+    int inliers;
+    free(pupil_fitting_inliers(floatCtx, 200, 160, inliers));
+  });
+  // the fits leave the normalized points behind, pick 5 spread around the ellipse
+  const int conicPoints[5] = {0, 32, 64, 96, 128};
+  double conic[6];
+  benchmark("conic through 5 points, elimination", iters, [&]() {
+    solve_conic_5_points(doubleCtx.nor_x.data(), doubleCtx.nor_y.data(), conicPoints, conic);
+  });
+
+  // the same seed has to give the same fit whatever the number of threads
+  ThreadPool pool;
+  StarburstContext serialCtx, parallelCtx;
+  serialCtx.edges.pos = parallelCtx.edges.pos = doubleCtx.edges.pos;
+  serialCtx.rng.seed(42);
+  parallelCtx.rng.seed(42);
+  parallelCtx.pool = &pool;
+  int serialInliers, parallelInliers;
+  free(pupil_fitting_inliers(serialCtx, 200, 160, serialInliers));
+  free(pupil_fitting_inliers(parallelCtx, 200, 160, parallelInliers));
+  bool same = serialInliers == parallelInliers && memcmp(serialCtx.pupil_param, parallelCtx.pupil_param, sizeof(serialCtx.pupil_param)) == 0;
+  std::cout << "ransac fit on " << pool.numThreads() << " threads " << (same ? "matches" : "DIFFERS FROM") << " the serial fit\n";
+  if(!same) failed = true;
+  benchmark("ransac ellipse fit, thread pool", iters, [&]() {
+    int inliers;
+    free(pupil_fitting_inliers(parallelCtx, 200, 160, inliers));
+  });
+
+  StarburstContext pupilCtx;
+  pupilCtx.pool = &pool;
+  PupilEstimate pupilEstimate = findEllipseStarburst(pupilCtx, eye);
+  std::cout << "starburst pupil " << pupilEstimate.ellipse.center << " " << pupilEstimate.ellipse.size
+            << " confidence " << pupilEstimate.confidence << "\n";
+  benchmark("starburst pupil, whole stage", iters, [&]() {
+    findEllipseStarburst(pupilCtx, eye);
+  });
+
+  deleteGens(gens);
+  if(jsonPath && !writeJSON(jsonPath, iters, pool.numThreads())) return 1;
+  return failed ? 1 : 0;
+}
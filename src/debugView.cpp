@@ -0,0 +1,165 @@
+// The SmartGaze Eye Tracker
+// Copyright (C) 2016  Tristan Hume
+// Released under GPLv2, see LICENSE file for full text
+
+#include "debugView.h"
+
+#include <opencv2/highgui/highgui.hpp>
+
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#ifdef __APPLE__
+#include <pthread.h>
+#else
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#include "starburst.h"
+
+static const double kDebugBrightness = (265.0/256.0)*2.0;
+
+using namespace cv;
+
+struct DebugSink {
+  std::thread thread;
+  std::mutex mutex;
+  std::condition_variable cond;
+  bool stopping = false;
+  bool hasPending = false;
+  DebugFrame pending;
+
+  std::mutex shownMutex;
+  std::vector<std::pair<std::string, Mat> > drawn; // views not yet passed to imshow
+};
+
+static void lowerThreadPriority() {
+#ifdef __APPLE__
+  pthread_set_qos_class_self_np(QOS_CLASS_BACKGROUND, 0);
+#else
+  // on Linux niceness is per thread
+  setpriority(PRIO_PROCESS, syscall(SYS_gettid), 19);
+#endif
+}
+
+static Mat drawMain(DebugFrame &frame) {
+  Mat m;
+  frame.image.convertTo(m, CV_8U, kDebugBrightness, 0);
+  Mat channels[3];
+  channels[1] = m;
+  channels[0] = channels[2] = min(m, frame.glintMask);
+  Mat debugImage;
+  merge(channels,3,debugImage);
+
+  for(Point2f glint : frame.glints)
+    circle(debugImage, Point(cvRound(glint.x), cvRound(glint.y)), 3, Scalar(255,0,255));
+  return debugImage;
+}
+
+static Mat drawPolar(DebugEyeView &eye) {
+  Mat polarDebug = Mat::zeros(200,200, CV_8UC3);
+  for(auto &&p : eye.polarPoints) {
+    circle(polarDebug, Point(p.first.x,p.first.y), 1, Scalar(100,0,100 + (p.second*50 % 155)));
+  }
+  for(Point2f median : eye.polarMedians) {
+    circle(polarDebug, Point(median.x,median.y), 2, Scalar(0,255,0));
+  }
+  return polarDebug;
+}
+
+static Mat drawEye(DebugEyeView &eye) {
+  Mat debugImage;
+  cvtColor(eye.region, debugImage, CV_GRAY2RGB);
+  for(Point2f p : eye.goodPoints) {
+    Point intPt(p.x, p.y);
+    circle(debugImage, intPt, 2, Scalar(0,0,255));
+  }
+  circle(debugImage, eye.seed, 2, Scalar(0,0,255));
+  ellipse(debugImage, eye.fittedAll, Scalar(255, 255, 0));
+  ellipse(debugImage, eye.fittedFiltered, Scalar(0, 255, 255));
+  ellipse(debugImage, eye.pupil, Scalar(0, 255, 0), 2);
+  circle(debugImage, eye.pupil.center, 2, Scalar(0,255, 0));
+  putText(debugImage, std::to_string((int)(eye.confidence*100)) + "%", Point(4, 14), FONT_HERSHEY_PLAIN, 1, Scalar(0, 255, 0));
+  return debugImage;
+}
+
+static void debugLoop(DebugSink *sink) {
+  lowerThreadPriority();
+  std::unique_lock<std::mutex> lock(sink->mutex);
+  while(true) {
+    sink->cond.wait(lock, [sink]() { return sink->stopping || sink->hasPending; });
+    if(sink->stopping) return;
+    DebugFrame frame;
+    std::swap(frame, sink->pending);
+    sink->hasPending = false;
+    lock.unlock();
+
+    std::vector<std::pair<std::string, Mat> > views;
+    views.push_back(std::make_pair(std::string("main"), drawMain(frame)));
+    for(unsigned i = 0; i < frame.eyes.size(); ++i) {
+      views.push_back(std::make_pair(std::to_string(i), drawEye(frame.eyes[i])));
+      views.push_back(std::make_pair(std::to_string(i)+"_polar", drawPolar(frame.eyes[i])));
+    }
+    {
+      std::lock_guard<std::mutex> shownLock(sink->shownMutex);
+      sink->drawn.swap(views);
+    }
+
+    lock.lock();
+  }
+}
+
+DebugSink *createDebugSink() {
+  DebugSink *sink = new DebugSink();
+  sink->thread = std::thread(debugLoop, sink);
+  return sink;
+}
+
+void deleteDebugSink(DebugSink *sink) {
+  {
+    std::lock_guard<std::mutex> lock(sink->mutex);
+    sink->stopping = true;
+  }
+  sink->cond.notify_one();
+  sink->thread.join();
+  delete sink;
+}
+
+void submitDebugFrame(DebugSink *sink, DebugFrame &frame) {
+  std::unique_lock<std::mutex> lock(sink->mutex, std::try_to_lock);
+  if(!lock.owns_lock()) return; // the debug thread is swapping frames, skip this one
+  std::swap(sink->pending, frame);
+  sink->hasPending = true;
+  lock.unlock();
+  sink->cond.notify_one();
+}
+
+void showDebugViews(DebugSink *sink) {
+  std::vector<std::pair<std::string, Mat> > views;
+  {
+    std::lock_guard<std::mutex> lock(sink->shownMutex);
+    views.swap(sink->drawn);
+  }
+  for(auto &&view : views)
+    imshow(view.first, view.second);
+}
+
+void setupDebugWindows() {
+  cv::namedWindow("main",CV_WINDOW_NORMAL);
+  cv::namedWindow("0",CV_WINDOW_NORMAL);
+  cv::namedWindow("1",CV_WINDOW_NORMAL);
+  cv::namedWindow("0_polar",CV_WINDOW_NORMAL);
+  cv::namedWindow("1_polar",CV_WINDOW_NORMAL);
+  cv::moveWindow("main", 600, 600);
+  cv::moveWindow("0", 400, 50);
+  cv::moveWindow("1", 600, 50);
+  cv::moveWindow("0_polar", 400, 300);
+  cv::moveWindow("1_polar", 600, 300);
+  // cv::namedWindow("glint",CV_WINDOW_NORMAL);
+  createTrackbar("Starburst thresh", "main", &starThresh, 180);
+  createTrackbar("Starburst rays", "main", &starRays, 80);
+}
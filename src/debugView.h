@@ -0,0 +1,45 @@
+// The SmartGaze Eye Tracker
+// Copyright (C) 2016  Tristan Hume
+// Released under GPLv2, see LICENSE file for full text
+#ifndef DEBUGVIEW_H__
+#define DEBUGVIEW_H__
+
+#include <opencv2/imgproc/imgproc.hpp>
+#include <utility>
+#include <vector>
+
+// The raw ingredients of an eye's debug view. Tracking only fills these in,
+// all the drawing happens later on the debug thread.
+struct DebugEyeView {
+  cv::Mat region; // 8 bit eye image after glint removal
+  cv::Point seed; // darkest point starburst started from
+  std::vector<std::pair<cv::Point2f,int> > polarPoints; // (angle, radius) and filter segment
+  std::vector<cv::Point2f> polarMedians;
+  std::vector<cv::Point2f> goodPoints;
+  cv::RotatedRect fittedAll;
+  cv::RotatedRect fittedFiltered;
+  cv::RotatedRect pupil; // the candidate that won
+  float confidence;
+  DebugEyeView() : confidence(0) {}
+};
+
+struct DebugFrame {
+  cv::Mat image;     // half size 8 bit frame
+  cv::Mat glintMask; // 0 where glints are
+  std::vector<cv::Point2f> glints;
+  std::vector<DebugEyeView> eyes;
+};
+
+// Draws debug views on a low priority thread. Frames that arrive while the
+// previous one is still being drawn replace it, so tracking never waits.
+struct DebugSink;
+DebugSink *createDebugSink();
+void deleteDebugSink(DebugSink *sink);
+// never blocks, the frame may be dropped
+void submitDebugFrame(DebugSink *sink, DebugFrame &frame);
+// shows the latest drawn views, must be called from the thread running the HighGUI event loop
+void showDebugViews(DebugSink *sink);
+
+void setupDebugWindows();
+
+#endif
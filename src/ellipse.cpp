@@ -3,7 +3,8 @@
 // Released under GPLv2, see LICENSE file for full text
 #include "ellipse.h"
 
-#include <opencv2/highgui/highgui.hpp>
+#include <assert.h>
+#include <algorithm>
 #include <cmath>
 #include <cstdint>
 
@@ -11,23 +12,72 @@ using namespace cv;
 
 #include "ellipse2Poly.h"
 
-// Modified from http://stackoverflow.com/questions/13299409/how-to-get-the-image-pixel-at-real-locations-in-opencv
-static uint8_t getPixelSubpix(const cv::Mat& img, cv::Point2f pt) {
-  cv::Mat patch;
-  cv::getRectSubPix(img, cv::Size(1,1), pt, patch);
-  return patch.at<uint8_t>(0,0);
+// how far inside and outside the contour the gradient is measured, in pixels
+static const float kContourOffset = 2.0f;
+// most contour samples, at one per degree
+static const int kMaxContourPoints = 360+2;
+
+void sampleBilinear(const Mat &m, const std::vector<Point2f> &pts, float *values, EllipseScoreBuffers &buffers) {
+  assert(m.type() == CV_8UC1 && m.cols >= 2 && m.rows >= 2);
+  int n = pts.size();
+  buffers.offset.resize(n);
+  buffers.fx.resize(n);
+  buffers.fy.resize(n);
+  int32_t *offset = buffers.offset.data();
+  float *fx = buffers.fx.data(), *fy = buffers.fy.data();
+  const float maxX = m.cols-1.001f, maxY = m.rows-1.001f;
+  const int32_t step = m.step;
+
+  // The gathers are the only part that can't run in vector lanes, so the work is split around them:
+  // positions and weights first, then the four pixel loads per sample, then the blend.
+  for(int i = 0; i < n; i++) {
+    float x = std::min(std::max(pts[i].x, 0.0f), maxX);
+    float y = std::min(std::max(pts[i].y, 0.0f), maxY);
+    int32_t ix = (int32_t)x, iy = (int32_t)y;
+    offset[i] = iy*step + ix;
+    fx[i] = x - ix;
+    fy[i] = y - iy;
+  }
+  const uint8_t *data = m.data;
+  float *top = values;
+  std::vector<float> &bottomBuf = buffers.value;
+  bottomBuf.resize(n);
+  float *bottom = bottomBuf.data();
+  for(int i = 0; i < n; i++) {
+    const uint8_t *p = data + offset[i];
+    float a = p[0], b = p[1], c = p[step], d = p[step+1];
+    top[i] = a + (b-a)*fx[i];
+    bottom[i] = c + (d-c)*fx[i];
+  }
+  for(int i = 0; i < n; i++)
+    values[i] = top[i] + (bottom[i]-top[i])*fy[i];
 }
 
-static float ellipseContourIntegral(Mat &m, const RotatedRect &r) {
-  std::vector<Point2f> pts;
-  ellipsePoints(r, 0, 360, 2, pts);
+// Mean of (outside - inside) over matching points of the contours kContourOffset outside and inside r.
+// Both polygons come from ellipsePoints with the same parameter angles, so point i of each lie on
+// the same line through the ellipse and their difference is a finite difference across the edge.
+static float ellipseContourIntegral(const Mat &m, const RotatedRect &r, EllipseScoreBuffers &buffers, int delta) {
+  RotatedRect innerRect = r, outerRect = r;
+  innerRect.size.width = std::max(r.size.width - 2*kContourOffset, 1.0f);
+  innerRect.size.height = std::max(r.size.height - 2*kContourOffset, 1.0f);
+  outerRect.size.width += 2*kContourOffset;
+  outerRect.size.height += 2*kContourOffset;
+  ellipsePoints(innerRect, 0, 360, delta, buffers.inner);
+  ellipsePoints(outerRect, 0, 360, delta, buffers.outer);
 
-  // for(Point2f p : pts) {
-  //   Point p2(cvRound(p.x), cvRound(p.y));
-  //   circle(m, p2, 0, Scalar(0));
-  // }
+  // the polygons have the same number of points, the fixed angle step sets it
+  int n = std::min(buffers.inner.size(), buffers.outer.size());
+  float inside[kMaxContourPoints], outside[kMaxContourPoints];
+  assert(buffers.inner.size() <= kMaxContourPoints && buffers.outer.size() <= kMaxContourPoints);
+  float sum = 0;
+  sampleBilinear(m, buffers.inner, inside, buffers);
+  sampleBilinear(m, buffers.outer, outside, buffers);
+  for(int i = 0; i < n; i++)
+    sum += outside[i] - inside[i];
+  return sum / n;
 }
 
-float ellipseScore(Mat &m, RotatedRect r) {
-  ellipseContourIntegral(m, r);
+float ellipseScore(const Mat &m, const RotatedRect &r, EllipseScoreBuffers &buffers, int degreesPerSample) {
+  if(!(r.size.width > 0 && r.size.height > 0)) return 0;
+  return ellipseContourIntegral(m, r, buffers, std::max(degreesPerSample, 1)) / (2*kContourOffset);
 }
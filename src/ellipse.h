@@ -5,7 +5,25 @@
 #define ELLIPSE_H__
 
 #include <opencv2/imgproc/imgproc.hpp>
+#include <stdint.h>
+#include <vector>
 
-float ellipseScore(cv::Mat &m, cv::RotatedRect r);
+// Scratch space for ellipseScore, keep one per thread so scoring doesn't allocate.
+struct EllipseScoreBuffers {
+  std::vector<cv::Point2f> inner, outer; // contour polygons just inside and outside the ellipse
+  std::vector<int32_t> offset;           // top left pixel of each bilinear sample
+  std::vector<float> fx, fy;             // and its fractional position
+  std::vector<float> value;
+};
+
+// Bilinear samples of the 8 bit image m at pts, with coordinates clamped to the image like
+// getRectSubPix's replicated border. Written to values, which must have room for every point.
+void sampleBilinear(const cv::Mat &m, const std::vector<cv::Point2f> &pts, float *values, EllipseScoreBuffers &buffers);
+
+// How strongly the image gets brighter going out across the edge of r, the mean intensity
+// gradient along the outward normal in levels per pixel. A dark pupil with a well fitting
+// ellipse scores high, 0 for a degenerate ellipse. The contour is sampled every degreesPerSample
+// degrees, larger steps give a cheaper, rougher score.
+float ellipseScore(const cv::Mat &m, const cv::RotatedRect &r, EllipseScoreBuffers &buffers, int degreesPerSample = 2);
 
 #endif
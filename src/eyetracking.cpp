@@ -4,178 +4,182 @@
 
 #include "eyetracking.h"
 
-#include <opencv2/highgui/highgui.hpp>
 #include <opencv2/photo/photo.hpp>
-#include <iostream>
-#include <chrono>
+#include <algorithm>
+#include <string.h>
 #include <utility>
 
+#include "debugView.h"
+#include "glintFill.h"
+#include "glints.h"
 #include "halideFuncs.h"
+#include "instrument.h"
 #include "starburst.h"
+#include "threadPool.h"
 
-static const int kFirstGlintXShadow = 100;
-static const int kGlintNeighbourhood = 100;
 static const int kEyeRegionWidth = 200;
 static const int kEyeRegionHeight = 160;
-static const int kGlintIntensityRegionDist = 80;
-static const double kGlintRegionIntensityThresh = 240.0;
 static const double k8BitScale = (265.0/1024.0)*2.0;
 
 using namespace cv;
 
 struct TrackingData {
   HalideGens *gens;
-  TrackingData() {
+  DebugSink *debugSink; // null when headless
+  ThreadPool pool;
+  std::vector<StarburstContext> eyes;
+  std::vector<GlintFillBuffers> fillBuffers; // one per eye
+  std::vector<PupilEstimate> pupils; // latest pupil of each eye, in full frame coordinates
+  std::vector<Point> defectivePixels;
+  GlintTracker glintTracker;
+  Mat gray, glintMask; // front end output reused between frames, only when nothing else holds on to it
+  bool inpaintGlints;
+  bool ransacSinglePrecision;
+  unsigned ransacSeed;
+  TrackingData(const TrackingOptions &opts) : pool(opts.threads), defectivePixels(opts.defectivePixels), inpaintGlints(opts.inpaintGlints),
+                                              ransacSinglePrecision(opts.ransacSinglePrecision), ransacSeed(opts.ransacSeed) {
+    glintTracker.temporal = opts.temporalGlints;
     gens = createGens();
+    debugSink = opts.debugView ? createDebugSink() : nullptr;
   }
   ~TrackingData() {
+    if(debugSink) deleteDebugSink(debugSink);
     deleteGens(gens);
   }
 };
 
-// search for other set pixels in an area around the point and find the average of the set locations
-static Point findLocalCenter(Mat &m, Point p, int size) {
-  int xSum = 0;
-  int ySum = 0;
-  int count = 0;
-  for(int i = std::max(0,p.y-size); i < std::min(m.rows,p.y+size); i++) {
-    const uint8_t* Mi = m.ptr<uint8_t>(i);
-    for(int j = std::max(0,p.x-size); j < std::min(m.cols,p.x+size); j++) {
-      if(Mi[j] == 0) {
-        xSum += j; ySum += i;
-        count += 1;
-      }
-    }
-  }
-  if(count == 0) return Point(0,0);
-  return Point(xSum/count, ySum/count);
+// fills in one eye of the result, the glint is in half size frame pixels
+static void fillEyeResult(EyeResult &eye, Point2f glint, const PupilEstimate &pupil) {
+  eye.glintX = glint.x*2;
+  eye.glintY = glint.y*2;
+  eye.pupilX = pupil.ellipse.center.x;
+  eye.pupilY = pupil.ellipse.center.y;
+  eye.pupilWidth = pupil.ellipse.size.width;
+  eye.pupilHeight = pupil.ellipse.size.height;
+  eye.pupilAngle = pupil.ellipse.angle;
+  eye.confidence = pupil.confidence;
 }
 
-// find the average intensity above and beside a point
-static double findLocalIntensity(Mat &m, Point p, int size) {
-  int sum = 0;
-  int numPixels = 0;
-  for(int i = std::max(0,p.y-size); i < p.y; i++) {
-    const uint16_t* Mi = m.ptr<uint16_t>(i);
-    for(int j = std::max(0,p.x-size); j < std::min(m.cols,p.x+size); j++) {
-      sum += Mi[j];
-      numPixels += 1;
-    }
-  }
-  return ((double)(sum))/numPixels;
-}
+TrackingResult trackFrame(TrackingData *dat, Mat &bigM, uint64_t sequence, int64_t captureTimeUs) {
+  INSTRUMENT_STAGE(kStageFrame);
 
-static std::vector<Point> trackGlints(TrackingData *dat, Mat &m, Mat &rawInput) {
-  // double maxVal;
-  // Point maxPt;
-  // minMaxLoc(m, nullptr, &maxVal, nullptr, &maxPt);
-  // std::cout << "max val: " << maxVal << " at " << maxPt << std::endl;
-  // threshold(m, m, maxVal*kGlintThreshold, 255, THRESH_BINARY_INV);
-  // adaptiveThreshold(m, m, 1, ADAPTIVE_THRESH_MEAN_C, THRESH_BINARY, 11, -10.0);
-  adaptiveThreshold(m, m, 255, ADAPTIVE_THRESH_MEAN_C, THRESH_BINARY_INV, 11, -40.0);
-
-  // search for first two pixels separated sufficiently horizontally
-  // start from the top and only take the first two so that glints off of teeth and headphones are ignored.
-  std::vector<Point> result;
-  for(int i = 0; i < m.rows; i++) {
-    if(result.size() >= 2) break;
-    const uint8_t* Mi = m.ptr<uint8_t>(i);
-    for(int j = 0; j < m.cols; j++) {
-      if(Mi[j] == 0) {
-        if(!result.empty() && !(j > result[0].x+kFirstGlintXShadow || j < result[0].x-kFirstGlintXShadow)) {
-          continue; // skip points too close to first point
-        }
-        Point pt(j,i);
-        double avgIntensity = findLocalIntensity(rawInput, pt, kGlintIntensityRegionDist);
-        // std::cout << "average intensity: " << avgIntensity << std::endl;
-        if(avgIntensity < kGlintRegionIntensityThresh) continue; // probably glint off dark hair
-        result.push_back(pt);
-        if(result.size() >= 2) break;
-      }
-    }
+  // paste over stuck pixels with their left neighbour, only touches the listed pixels
+  for(Point p : dat->defectivePixels) {
+    if(p.x >= 1 && p.x < bigM.cols && p.y >= 0 && p.y < bigM.rows)
+      bigM.at<uint16_t>(p.y,p.x) = bigM.at<uint16_t>(p.y,p.x-1);
   }
-  // Make the found point more centered on the eye instead of being just the first one
-  for(auto &&p : result)
-    p = findLocalCenter(m,p, kGlintNeighbourhood);
-
-  // consistent order, purely so debug views aren't jittery
-  std::sort(result.begin(), result.end(), [](Point a, Point b) {
-      return a.x < b.x;
-  });
-
-  return result;
-}
-
-void trackFrame(TrackingData *dat, Mat &bigM) {
-  std::chrono::time_point<std::chrono::high_resolution_clock> start, end;
-  start = std::chrono::high_resolution_clock::now();
 
-  // fix stuck pixel on my EyeTribe by pasting over it
-  // TODO: don't enable this for everyone else
-  bigM.at<uint16_t>(283,627) = bigM.at<uint16_t>(283,626);
-
-  Mat m;
-  resize(bigM, m, Size(bigM.cols/2,bigM.rows/2));
-
-  Mat glintImage;
-  m.convertTo(glintImage, CV_8U, 256.0/1024.0);
+  // half size 8 bit image and glint mask in a single pass over the frame
+  // the debug view keeps each frame's images, so they can only be reused without one
+  Mat m, glintImage;
+  if(!dat->debugSink) {
+    m = dat->gray;
+    glintImage = dat->glintMask;
+  }
+  {
+    INSTRUMENT_STAGE(kStageFrontEnd);
+    frontEnd(dat->gens, bigM, m, glintImage);
+  }
+  if(!dat->debugSink) {
+    dat->gray = m;
+    dat->glintMask = glintImage;
+  }
   // glintImage = glintKernel(dat->gens, m);
-  auto glints = trackGlints(dat, glintImage, m);
+  std::vector<Point2f> glints;
+  {
+    INSTRUMENT_STAGE(kStageGlints);
+    glints = trackGlints(dat->glintTracker, glintImage, m);
+  }
   // Mat foundGlints = findGlints(dat->gens, glintImage);
 
 
+  DebugFrame debug;
+  if(dat->debugSink) debug.eyes.resize(glints.size());
+
+  // eyes are independent so process them concurrently, each with its own starburst context
+  if(dat->eyes.size() < glints.size()) {
+    unsigned oldSize = dat->eyes.size();
+    dat->eyes.resize(glints.size());
+    dat->fillBuffers.resize(glints.size());
+    // every eye gets its own stream, fixed by the seed so a replay gives the same fits every run
+    for(unsigned i = oldSize; i < glints.size(); ++i) {
+      dat->eyes[i].rng.seed(dat->ransacSeed + i);
+      dat->eyes[i].pool = &dat->pool;
+    }
+  }
+  dat->pupils.resize(glints.size());
   for(unsigned i = 0; i < glints.size(); ++i) {
+    dat->eyes[i].debug = dat->debugSink ? &debug.eyes[i] : nullptr;
+    dat->eyes[i].single_precision = dat->ransacSinglePrecision;
+  }
+  dat->pool.parallelFor(glints.size(), [&](int i) {
     // project onto big image
-    Rect smallRoi = Rect(glints[i].x-(kEyeRegionWidth/4),glints[i].y-(kEyeRegionHeight/4),kEyeRegionWidth/2,kEyeRegionHeight/2) & Rect(0,0,m.cols,m.rows);
-    Rect roi = Rect(glints[i].x*2-(kEyeRegionWidth/2),glints[i].y*2-(kEyeRegionHeight/2),kEyeRegionWidth,kEyeRegionHeight) & Rect(0,0,bigM.cols,bigM.rows);
+    Point glint(cvRound(glints[i].x), cvRound(glints[i].y));
+    Rect smallRoi = Rect(glint.x-(kEyeRegionWidth/4),glint.y-(kEyeRegionHeight/4),kEyeRegionWidth/2,kEyeRegionHeight/2) & Rect(0,0,m.cols,m.rows);
+    Rect roi = Rect(glint.x*2-(kEyeRegionWidth/2),glint.y*2-(kEyeRegionHeight/2),kEyeRegionWidth,kEyeRegionHeight) & Rect(0,0,bigM.cols,bigM.rows);
     Mat region(bigM, roi);
-    // Mat region(m, smallRoi);
-    region.convertTo(region, CV_8U, k8BitScale, 0);
-    // imshow(std::to_string(i)+"_raw", region);
-    blur(region, region, Size(3,3));
-
-    // inpaint over the glints so they don't mess up further stages
-    Mat glintMask = Mat(glintImage, smallRoi).clone();
-    threshold(glintMask, glintMask, 0, 255, THRESH_BINARY_INV); // invert mask
-    dilate(glintMask, glintMask, getStructuringElement(MORPH_RECT, Size(4,4))); // without this it inpaints white
-    resize(glintMask, glintMask, roi.size());
-    inpaint(region, glintMask, region, 4, INPAINT_NS);
-
-    findEllipseStarburst(region, std::to_string(i));
-  }
+    {
+      INSTRUMENT_STAGE(kStageEyeRegion);
+      // Mat region(m, smallRoi);
+      region.convertTo(region, CV_8U, k8BitScale, 0);
+      // imshow(std::to_string(i)+"_raw", region);
+      blur(region, region, Size(3,3));
+    }
+
+    // paint over the glints so they don't mess up further stages
+    {
+      INSTRUMENT_STAGE(kStageGlintRemoval);
+      if(dat->inpaintGlints) {
+        Mat glintMask = Mat(glintImage, smallRoi).clone();
+        threshold(glintMask, glintMask, 0, 255, THRESH_BINARY_INV); // invert mask
+        dilate(glintMask, glintMask, getStructuringElement(MORPH_RECT, Size(4,4))); // without this it inpaints white
+        resize(glintMask, glintMask, roi.size());
+        inpaint(region, glintMask, region, 4, INPAINT_NS);
+      } else {
+        fillGlints(region, Mat(glintImage, smallRoi), dat->fillBuffers[i]);
+      }
+    }
 
-  end = std::chrono::high_resolution_clock::now();
-  std::cout << "elapsed time: " << std::chrono::duration_cast<std::chrono::milliseconds>(end-start).count() << "ms\n";
+    PupilEstimate pupil = findEllipseStarburst(dat->eyes[i], region);
+    // without a pupil the ellipse stays all 0, as the result promises
+    if(pupil.confidence > 0) pupil.ellipse.center += Point2f(roi.x, roi.y);
+    dat->pupils[i] = pupil;
+  });
 
-  m.convertTo(m, CV_8U, k8BitScale, 0);
-  Mat channels[3];
-  channels[1] = m;
-  channels[0] = channels[2] = min(m, glintImage);
-  Mat debugImage;
-  merge(channels,3,debugImage);
-  // debugImage = glintImage;
+  TrackingResult result;
+  memset(&result, 0, sizeof(result));
+  result.sequence = sequence;
+  result.captureTimeUs = captureTimeUs;
+  result.numEyes = std::min((int)glints.size(), kMaxTrackedEyes);
+  for(unsigned i = 0; i < result.numEyes; ++i)
+    fillEyeResult(result.eyes[i], glints[i], dat->pupils[i]);
+
+  // the images are fresh each frame so handing over their headers doesn't copy anything
+  if(dat->debugSink) {
+    debug.image = m;
+    debug.glintMask = glintImage;
+    debug.glints = glints;
+    submitDebugFrame(dat->debugSink, debug);
+  }
+  return result;
+}
+
+void showTrackingDebug(TrackingData *dat) {
+  if(dat->debugSink) showDebugViews(dat->debugSink);
+}
 
-  for(auto glint : glints)
-    circle(debugImage, glint, 3, Scalar(255,0,255));
+TrackingData *setupTracking(const TrackingOptions &opts) {
+  if(opts.debugView) setupDebugWindows();
+  return new TrackingData(opts);
+}
 
-  // bigM.convertTo(bigM, CV_8U, k8BitScale, 0);
-  // imshow("main", bigM);
-  imshow("main", debugImage);
+void deleteTracking(TrackingData *dat) {
+  delete dat;
 }
 
-TrackingData *setupTracking() {
-  cv::namedWindow("main",CV_WINDOW_NORMAL);
-  cv::namedWindow("0",CV_WINDOW_NORMAL);
-  cv::namedWindow("1",CV_WINDOW_NORMAL);
-  cv::namedWindow("0_polar",CV_WINDOW_NORMAL);
-  cv::namedWindow("1_polar",CV_WINDOW_NORMAL);
-  cv::moveWindow("main", 600, 600);
-  cv::moveWindow("0", 400, 50);
-  cv::moveWindow("1", 600, 50);
-  cv::moveWindow("0_polar", 400, 300);
-  cv::moveWindow("1_polar", 600, 300);
-  // cv::namedWindow("glint",CV_WINDOW_NORMAL);
-  createTrackbar("Starburst thresh", "main", &starThresh, 180);
-  createTrackbar("Starburst rays", "main", &starRays, 80);
-  return new TrackingData();
+void resetTracking(TrackingData *dat) {
+  dat->glintTracker.reset();
+  dat->pupils.clear();
+  for(unsigned i = 0; i < dat->eyes.size(); ++i)
+    dat->eyes[i].rng.seed(dat->ransacSeed + i);
 }
@@ -5,11 +5,41 @@
 #define EYETRACKING_H__
 
 #include <opencv2/imgproc/imgproc.hpp>
+#include <stdint.h>
+#include <vector>
+
+#include "trackingResult.h"
+
+struct TrackingOptions {
+  // draw debug views on a background thread, when false no visualization work is done at all
+  bool debugView;
+  // stuck sensor pixels, each is replaced by its left neighbour before tracking
+  std::vector<cv::Point> defectivePixels;
+  // search for glints near where they were last frame, only scanning the whole frame when they are lost
+  bool temporalGlints;
+  // remove glints with OpenCV's Navier-Stokes inpainting instead of the fast fill, for comparing accuracy
+  bool inpaintGlints;
+  // score RANSAC ellipse hypotheses in single precision, twice as many points per vector
+  bool ransacSinglePrecision;
+  // seeds the RANSAC sampling so the same frames always give the same pupil fits
+  unsigned ransacSeed;
+  // threads splitting up the work within a frame, counting the caller, 0 uses ThreadPool::kDefaultThreads
+  int threads;
+
+  TrackingOptions() : debugView(true), temporalGlints(true), inpaintGlints(false), ransacSinglePrecision(false), ransacSeed(1),
+                      threads(0) {}
+};
 
 struct TrackingData;
 
-TrackingData *setupTracking();
-void trackFrame(TrackingData *dat, cv::Mat &m);
+TrackingData *setupTracking(const TrackingOptions &opts);
+void deleteTracking(TrackingData *dat);
+// forgets everything carried between frames, the next frame is tracked as if it were the first
+void resetTracking(TrackingData *dat);
+// tracks one full resolution 16 bit frame, the sequence number and capture time are passed through to the result
+TrackingResult trackFrame(TrackingData *dat, cv::Mat &m, uint64_t sequence, int64_t captureTimeUs);
+// shows the latest debug views, call from the thread running the HighGUI event loop
+void showTrackingDebug(TrackingData *dat);
 
 #endif
 
@@ -0,0 +1,48 @@
+// The SmartGaze Eye Tracker
+// Copyright (C) 2016  Tristan Hume
+// Released under GPLv2, see LICENSE file for full text
+
+#include "frameAccounting.h"
+#include "instrument.h"
+
+#include <inttypes.h>
+
+void FrameAccounting::frameReceived(const Frame &frame) {
+  uint64_t n = received.load(std::memory_order_relaxed);
+  // Unsigned difference so the 32 bit sequence can wrap. A jump backwards means the source
+  // restarted, which isn't lost frames, so only count forward jumps of under half the range.
+  uint32_t skipped = frame.sequence - lastSequence - 1;
+  if(n > 0 && skipped != 0 && skipped < 0x80000000u) {
+    gaps.store(gaps.load(std::memory_order_relaxed)+1, std::memory_order_relaxed);
+    missing.store(missing.load(std::memory_order_relaxed)+skipped, std::memory_order_relaxed);
+  }
+  lastSequence = frame.sequence;
+  received.store(n+1, std::memory_order_relaxed);
+}
+
+void FrameAccounting::frameTracked(const Frame &frame, int64_t startUs, int64_t endUs) {
+  int64_t latency = endUs - frame.capturedUs;
+  latencySumUs.store(latencySumUs.load(std::memory_order_relaxed)+latency, std::memory_order_relaxed);
+  if(latency > latencyMaxUs.load(std::memory_order_relaxed)) latencyMaxUs.store(latency, std::memory_order_relaxed);
+  tracked.store(tracked.load(std::memory_order_relaxed)+1, std::memory_order_relaxed);
+  recordStageTime(kStageQueueWait, frame.capturedUs*1000, startUs*1000);
+  recordStageTime(kStageLatency, frame.capturedUs*1000, endUs*1000);
+}
+
+FrameAccountingStats FrameAccounting::stats() const {
+  FrameAccountingStats s;
+  s.received = received.load();
+  s.tracked = tracked.load();
+  s.gaps = gaps.load();
+  s.missing = missing.load();
+  s.meanLatencyUs = s.tracked ? latencySumUs.load()/(int64_t)s.tracked : 0;
+  s.maxLatencyUs = latencyMaxUs.load();
+  return s;
+}
+
+void printFrameAccounting(FILE *f, const FrameAccountingStats &s) {
+  fprintf(f, "frames received: %" PRIu64 " tracked: %" PRIu64 " lost before arrival: %" PRIu64 " in %" PRIu64 " gaps,"
+             " capture to result mean %.2fms max %.2fms\n", s.received, s.tracked, s.missing, s.gaps,
+          s.meanLatencyUs/1000.0, s.maxLatencyUs/1000.0);
+  fflush(f);
+}
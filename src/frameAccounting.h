@@ -0,0 +1,45 @@
+// The SmartGaze Eye Tracker
+// Copyright (C) 2016  Tristan Hume
+// Released under GPLv2, see LICENSE file for full text
+#ifndef FRAMEACCOUNTING_H__
+#define FRAMEACCOUNTING_H__
+
+#include "frameSource.h"
+
+#include <atomic>
+#include <stdio.h>
+
+struct FrameAccountingStats {
+  uint64_t received; // frames delivered by the source
+  uint64_t tracked;  // frames with a result, received minus tracked were dropped or are still queued
+  uint64_t gaps;     // breaks in the source's sequence numbers
+  uint64_t missing;  // frames lost before reaching us, summed over all gaps
+  int64_t meanLatencyUs, maxLatencyUs; // from capture to the result being out
+};
+
+// Running counts of where frames went and how stale results are. frameReceived() is called on the
+// source thread and frameTracked() on the tracking thread, each only ever from one thread.
+// The latency distributions go into the kStageQueueWait and kStageLatency stage histograms.
+class FrameAccounting {
+  uint32_t lastSequence; // only touched from frameReceived()
+  std::atomic<uint64_t> received{0};
+  std::atomic<uint64_t> tracked{0};
+  std::atomic<uint64_t> gaps{0};
+  std::atomic<uint64_t> missing{0};
+  std::atomic<int64_t> latencySumUs{0};
+  std::atomic<int64_t> latencyMaxUs{0};
+public:
+  FrameAccounting() : lastSequence(0) {}
+  FrameAccounting(const FrameAccounting&) = delete;
+  FrameAccounting &operator=(const FrameAccounting&) = delete;
+
+  void frameReceived(const Frame &frame);
+  // startUs and endUs are monotonicUs() around tracking the frame
+  void frameTracked(const Frame &frame, int64_t startUs, int64_t endUs);
+
+  FrameAccountingStats stats() const;
+};
+
+void printFrameAccounting(FILE *f, const FrameAccountingStats &s);
+
+#endif
@@ -0,0 +1,184 @@
+// The SmartGaze Eye Tracker
+// Copyright (C) 2016  Tristan Hume
+// Released under GPLv2, see LICENSE file for full text
+
+#include "frameQueue.h"
+
+#include <string.h>
+
+static size_t roundUpPow2(size_t n) {
+  size_t p = 2;
+  while(p < n) p *= 2;
+  return p;
+}
+
+IndexRing::IndexRing(size_t capacity) : cells(capacity), mask(capacity-1), pushPos(0), popPos(0) {
+  for(size_t i = 0; i < capacity; ++i)
+    cells[i].seq.store(i, std::memory_order_relaxed);
+}
+
+bool IndexRing::push(int value) {
+  Cell *cell;
+  size_t pos = pushPos.load(std::memory_order_relaxed);
+  while(true) {
+    cell = &cells[pos & mask];
+    size_t seq = cell->seq.load(std::memory_order_acquire);
+    intptr_t diff = (intptr_t)(seq) - (intptr_t)(pos);
+    if(diff == 0) {
+      if(pushPos.compare_exchange_weak(pos, pos+1, std::memory_order_relaxed)) break;
+    } else if(diff < 0) {
+      return false; // full
+    } else {
+      pos = pushPos.load(std::memory_order_relaxed);
+    }
+  }
+  cell->value = value;
+  cell->seq.store(pos+1, std::memory_order_release);
+  return true;
+}
+
+bool IndexRing::pop(int &value) {
+  Cell *cell;
+  size_t pos = popPos.load(std::memory_order_relaxed);
+  while(true) {
+    cell = &cells[pos & mask];
+    size_t seq = cell->seq.load(std::memory_order_acquire);
+    intptr_t diff = (intptr_t)(seq) - (intptr_t)(pos+1);
+    if(diff == 0) {
+      if(popPos.compare_exchange_weak(pos, pos+1, std::memory_order_relaxed)) break;
+    } else if(diff < 0) {
+      return false; // empty
+    } else {
+      pos = popPos.load(std::memory_order_relaxed);
+    }
+  }
+  value = cell->value;
+  cell->seq.store(pos+mask+1, std::memory_order_release);
+  return true;
+}
+
+bool IndexRing::empty() const {
+  return pushPos.load(std::memory_order_acquire) == popPos.load(std::memory_order_acquire);
+}
+
+bool IndexRing::full() const {
+  return pushPos.load(std::memory_order_acquire) - popPos.load(std::memory_order_acquire) > mask;
+}
+
+// One buffer for each ready slot plus the one being tracked and the producer's spare,
+// so the producer always has somewhere to copy to.
+FrameQueue::FrameQueue(int capacity, int width, int height, OverflowPolicy policy)
+  : width(width), height(height), policy(policy),
+    ready(roundUpPow2(capacity)), freeBuffers(roundUpPow2(roundUpPow2(capacity)+2)),
+    spare(-1), current(-1) {
+  size_t numBuffers = roundUpPow2(capacity)+2;
+  buffers.resize(numBuffers);
+  frames.resize(numBuffers);
+  for(size_t i = 0; i < numBuffers; ++i) {
+    buffers[i].resize(width*height);
+    frames[i].data = buffers[i].data();
+    frames[i].width = width;
+    frames[i].height = height;
+    frames[i].timestampUs = 0;
+    frames[i].sequence = 0;
+    frames[i].capturedUs = 0;
+    freeBuffers.push(i);
+  }
+}
+
+void FrameQueue::wakeConsumer() {
+  // Pairs with the fence in acquire(). The ring publishes with a release store, which on its own
+  // may be reordered after this load of a different variable, leaving the consumer asleep on a
+  // frame until the next push.
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if(consumerWaiting.load()) {
+    std::lock_guard<std::mutex> lock(waitMutex);
+    waitCond.notify_one();
+  }
+}
+
+bool FrameQueue::push(const Frame &frame) {
+  if(frame.width != width || frame.height != height || closed) {
+    dropped++;
+    return false;
+  }
+  if(policy == kDropNewest && ready.full()) {
+    dropped++;
+    return false;
+  }
+
+  bool droppedAny = false;
+  int buf = spare;
+  spare = -1;
+  if(buf < 0 && !freeBuffers.pop(buf)) {
+    // every buffer is queued or being tracked, reuse the oldest queued one
+    if(policy == kDropNewest || !ready.pop(buf)) {
+      dropped++;
+      return false;
+    }
+    dropped++;
+    droppedAny = true;
+  }
+
+  Frame &slot = frames[buf];
+  memcpy(slot.data, frame.data, sizeof(uint16_t)*width*height);
+  slot.timestampUs = frame.timestampUs;
+  slot.sequence = frame.sequence;
+  slot.capturedUs = frame.capturedUs;
+
+  if(!ready.push(buf)) {
+    int oldest;
+    if(policy == kDropOldest && ready.pop(oldest)) {
+      // we are the only pusher so the slot we just emptied is still there
+      ready.push(buf);
+      spare = oldest;
+    } else {
+      spare = buf;
+      dropped++;
+      return false;
+    }
+    dropped++;
+    droppedAny = true;
+  }
+  enqueued++;
+  wakeConsumer();
+  return !droppedAny;
+}
+
+Frame *FrameQueue::acquire() {
+  int buf;
+  while(!ready.pop(buf)) {
+    std::unique_lock<std::mutex> lock(waitMutex);
+    consumerWaiting = true;
+    // The producer checks consumerWaiting after publishing, so either we see its
+    // frame here or it sees the flag and notifies once we are waiting. That needs
+    // both sides fenced between their store and their load.
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    waitCond.wait(lock, [this]() { return !ready.empty() || closed; });
+    consumerWaiting = false;
+    if(closed && ready.empty()) return nullptr;
+  }
+  current = buf;
+  return &frames[buf];
+}
+
+void FrameQueue::release() {
+  if(current < 0) return;
+  freeBuffers.push(current);
+  current = -1;
+  processed++;
+}
+
+void FrameQueue::close() {
+  closed = true;
+  std::lock_guard<std::mutex> lock(waitMutex);
+  waitCond.notify_all();
+}
+
+FrameQueueStats FrameQueue::stats() const {
+  FrameQueueStats s;
+  s.enqueued = enqueued.load();
+  s.processed = processed.load();
+  s.dropped = dropped.load();
+  return s;
+}
@@ -0,0 +1,86 @@
+// The SmartGaze Eye Tracker
+// Copyright (C) 2016  Tristan Hume
+// Released under GPLv2, see LICENSE file for full text
+#ifndef FRAMEQUEUE_H__
+#define FRAMEQUEUE_H__
+
+#include "frameSource.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <vector>
+
+enum OverflowPolicy {
+  kDropOldest, // discard the longest waiting frame to make room, keeps tracking on the freshest frames
+  kDropNewest, // discard the incoming frame, keeps a contiguous run of frames
+};
+
+struct FrameQueueStats {
+  uint64_t enqueued;  // frames accepted into the queue
+  uint64_t processed; // frames the consumer has finished with
+  uint64_t dropped;   // frames discarded on overflow, whether incoming or already queued
+};
+
+// Bounded lock-free queue of buffer indices (Vyukov's MPMC ring). The frame
+// queue uses it with one pushing and at most two popping threads.
+class IndexRing {
+  struct Cell {
+    std::atomic<size_t> seq;
+    int value;
+  };
+  std::vector<Cell> cells;
+  size_t mask;
+  std::atomic<size_t> pushPos;
+  std::atomic<size_t> popPos;
+public:
+  explicit IndexRing(size_t capacity); // capacity must be a power of two
+  bool push(int value);
+  bool pop(int &value);
+  bool empty() const;
+  bool full() const;
+};
+
+// Hands frames from the camera thread to a tracking thread without the camera
+// thread ever blocking. All frame buffers are allocated up front: the producer
+// copies into a free buffer and publishes its index, the consumer tracks the
+// buffer in place and hands it back once done.
+class FrameQueue {
+  int width, height;
+  OverflowPolicy policy;
+  std::vector<std::vector<uint16_t> > buffers;
+  std::vector<Frame> frames;
+  IndexRing ready;       // filled frames in arrival order
+  IndexRing freeBuffers; // buffers returned by the consumer
+  int spare;             // buffer owned by the producer, only touched from push()
+  int current;           // buffer owned by the consumer, only touched from acquire()/release()
+
+  std::atomic<uint64_t> enqueued{0};
+  std::atomic<uint64_t> processed{0};
+  std::atomic<uint64_t> dropped{0};
+
+  std::mutex waitMutex;
+  std::condition_variable waitCond;
+  std::atomic<bool> consumerWaiting{false};
+  std::atomic<bool> closed{false};
+
+  void wakeConsumer();
+public:
+  // capacity is rounded up to a power of two
+  FrameQueue(int capacity, int width, int height, OverflowPolicy policy);
+  FrameQueue(const FrameQueue&) = delete;
+  FrameQueue &operator=(const FrameQueue&) = delete;
+
+  // producer: copy a frame in, returns false if a frame had to be dropped to do so
+  bool push(const Frame &frame);
+  // consumer: blocks until a frame is ready, returns nullptr once closed and drained
+  Frame *acquire();
+  // consumer: done with the frame from the last acquire()
+  void release();
+  // wakes the consumer and makes acquire() return nullptr once the queue is empty
+  void close();
+
+  FrameQueueStats stats() const;
+};
+
+#endif
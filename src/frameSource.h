@@ -0,0 +1,50 @@
+// The SmartGaze Eye Tracker
+// Copyright (C) 2016  Tristan Hume
+// Released under GPLv2, see LICENSE file for full text
+#ifndef FRAMESOURCE_H__
+#define FRAMESOURCE_H__
+
+#include <stdint.h>
+
+#include <chrono>
+
+static const int kCaptureWidth = 1536;
+static const int kCaptureHeight = 1024;
+static const int kCaptureFPS = 60;
+
+// A raw frame from the tracker camera, 16 bits per pixel of which the low 10 are used.
+// The data is only valid for the duration of the callback it is passed to.
+struct Frame {
+  uint16_t *data;
+  int width;
+  int height;
+  int64_t timestampUs; // capture time in microseconds, relative to an arbitrary source specific epoch
+  uint32_t sequence;   // numbered by the source, consecutive unless frames were lost before reaching us
+  int64_t capturedUs;  // timestampUs on the monotonicUs() clock, 0 if unknown
+};
+
+// Microseconds on the monotonic clock, comparable between threads and between processes on the same machine.
+inline int64_t monotonicUs() {
+  return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+typedef void (*FrameCallback)(Frame &frame, void *userData);
+
+// Something that produces frames and calls a callback with them from its own thread.
+class FrameSource {
+public:
+  virtual ~FrameSource() {}
+  // returns false if the source could not be started
+  virtual bool start(FrameCallback cb, void *userData) = 0;
+  // blocks until the last callback has returned
+  virtual void stop() = 0;
+  // true once a finite source has delivered all of its frames
+  virtual bool finished() { return false; }
+  // device specific controls bound to keys in the main loop
+  virtual void handleKey(char key) {}
+};
+
+// The Eye Tribe tracker via libuvc, returns nullptr if no device could be opened.
+FrameSource *createUVCSource();
+
+#endif
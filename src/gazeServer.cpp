@@ -0,0 +1,565 @@
+// The SmartGaze Eye Tracker
+// Copyright (C) 2016  Tristan Hume
+// Released under GPLv2, see LICENSE file for full text
+
+#include "gazeServer.h"
+#include "frameSource.h"
+
+#include <stdio.h>
+
+#ifdef __linux__
+
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdarg.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+// A client whose unsent output grows past this skips frames until it catches up,
+// a couple of hundred JSON frames or a few thousand binary ones.
+static const size_t kMaxPendingOutput = 256*1024;
+// Past this it isn't reading at all, even replies to its own requests pile up, so it is dropped.
+static const size_t kMaxStalledOutput = 4*kMaxPendingOutput;
+// Requests are small, anything longer without a complete message is garbage.
+static const size_t kMaxRequestSize = 64*1024;
+// Results waiting for the server thread, if it falls this far behind the oldest are dropped.
+static const size_t kMaxQueuedResults = 64;
+static const int kListenBacklog = 16;
+
+struct Client {
+  int fd;
+  bool push;
+  bool binary;
+  bool waitingWritable; // registered for EPOLLOUT, output is flushed when the socket drains
+  std::string input;
+  std::string output;
+  size_t outputSent; // prefix of output already written
+  uint64_t framesSkipped;
+};
+
+struct GazeServer {
+  int epollFd;
+  int wakeFd; // eventfd, written when results are queued or the server is stopping
+  int tcpFd, unixFd;
+  std::string unixPath;
+  std::thread thread;
+  std::atomic<bool> stopping;
+  std::atomic<int> pushClients; // lets serveResult skip all work while nobody is listening
+
+  std::mutex queueMutex;
+  std::vector<TrackingResult> queued; // guarded by queueMutex
+  std::vector<TrackingResult> batch;  // server thread's swap partner for queued
+
+  std::unordered_map<int, Client> clients; // server thread only
+  std::string json;                        // scratch for formatting messages
+};
+
+// --- message formatting ---
+
+static void appendBinary(std::string &out, BinaryMessageType type, const void *payload, size_t length) {
+  BinaryMessageHeader header;
+  memcpy(header.magic, kBinaryMessageMagic, sizeof(header.magic));
+  header.type = type;
+  header.length = length;
+  header.version = kTrackingResultVersion;
+  out.append((const char*)&header, sizeof(header));
+  out.append((const char*)payload, length);
+}
+
+// Replies go out as JSON text, wrapped in a binary message for binary clients.
+static void sendReply(Client &c, const std::string &reply) {
+  if(c.binary) {
+    appendBinary(c.output, kBinaryJson, reply.data(), reply.size());
+  } else {
+    c.output += reply;
+    c.output += '\n';
+  }
+}
+
+static void appendf(std::string &out, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+static void appendf(std::string &out, const char *fmt, ...) {
+  char buf[512];
+  va_list args;
+  va_start(args, fmt);
+  int n = vsnprintf(buf, sizeof(buf), fmt, args);
+  va_end(args);
+  out.append(buf, std::min(n, (int)sizeof(buf)-1));
+}
+
+// The Eye Tribe's per eye object. Its pupil center is normalized to the camera image,
+// and the camera looks at the user so the eye on the image's left is their right eye.
+static void appendEyeTribeEye(std::string &out, const EyeResult *eye) {
+  float psize = 0, px = 0, py = 0;
+  if(eye && eye->confidence > 0) {
+    psize = (eye->pupilWidth+eye->pupilHeight)/2;
+    px = eye->pupilX/kCaptureWidth;
+    py = eye->pupilY/kCaptureHeight;
+  }
+  appendf(out, "{\"raw\":{\"x\":0,\"y\":0},\"avg\":{\"x\":0,\"y\":0},\"psize\":%.2f,\"pcenter\":{\"x\":%.5f,\"y\":%.5f}}",
+          psize, px, py);
+}
+
+// Eye Tribe tracker states
+enum {
+  kStateTrackingEyes = 0x2,
+  kStateTrackingPresence = 0x4,
+  kStateTrackingLost = 0x10,
+};
+
+static void formatFrame(std::string &out, const TrackingResult &r) {
+  out.clear();
+  // the Eye Tribe sends local time both as text and as milliseconds
+  time_t seconds = r.captureTimeUs/1000000;
+  struct tm local;
+  localtime_r(&seconds, &local);
+  char date[32];
+  strftime(date, sizeof(date), "%Y-%m-%d %H:%M:%S", &local);
+
+  // the camera faces the user, so the eye on the left of the image is their right. eyes[] is already
+  // ordered left to right, a lone eye can only be placed by which half of the image it is in.
+  const EyeResult *userRight = nullptr, *userLeft = nullptr;
+  if(r.numEyes >= 2) {
+    userRight = &r.eyes[0];
+    userLeft = &r.eyes[1];
+  } else if(r.numEyes == 1) {
+    if(r.eyes[0].glintX < kCaptureWidth/2) userRight = &r.eyes[0]; else userLeft = &r.eyes[0];
+  }
+  int state = r.numEyes > 0 ? kStateTrackingEyes | kStateTrackingPresence : kStateTrackingLost;
+
+  appendf(out, "{\"category\":\"tracker\",\"request\":\"get\",\"statuscode\":200,\"values\":{\"frame\":{"
+               "\"timestamp\":\"%s.%03d\",\"time\":%" PRId64 ",\"fix\":false,\"state\":%d,"
+               "\"raw\":{\"x\":0,\"y\":0},\"avg\":{\"x\":0,\"y\":0},\"lefteye\":",
+          date, (int)(r.captureTimeUs/1000%1000), r.captureTimeUs/1000, state);
+  appendEyeTribeEye(out, userLeft);
+  out += ",\"righteye\":";
+  appendEyeTribeEye(out, userRight);
+  appendf(out, ",\"smartgaze\":{\"sequence\":%" PRIu64 ",\"latency_us\":%" PRId64 ",\"eyes\":[", r.sequence,
+          r.capturedUs ? r.resultUs - r.capturedUs : 0);
+  for(unsigned i = 0; i < r.numEyes; ++i) {
+    const EyeResult &e = r.eyes[i];
+    appendf(out, "%s{\"glint\":{\"x\":%.1f,\"y\":%.1f},\"pupil\":{\"x\":%.2f,\"y\":%.2f,\"width\":%.2f,\"height\":%.2f,"
+                 "\"angle\":%.1f},\"confidence\":%.3f}",
+            i ? "," : "", e.glintX, e.glintY, e.pupilX, e.pupilY, e.pupilWidth, e.pupilHeight, e.pupilAngle, e.confidence);
+  }
+  out += "]}}}}";
+}
+
+// --- request handling ---
+
+// Just enough JSON to read Eye Tribe requests, which are flat apart from the values object:
+// finds "key" followed by a colon and returns where its value starts, or nullptr.
+static const char *findValue(const std::string &msg, const char *key) {
+  std::string quoted = std::string("\"") + key + "\"";
+  size_t pos = 0;
+  while((pos = msg.find(quoted, pos)) != std::string::npos) {
+    pos += quoted.size();
+    size_t colon = msg.find_first_not_of(" \t\r\n", pos);
+    if(colon != std::string::npos && msg[colon] == ':') {
+      size_t value = msg.find_first_not_of(" \t\r\n", colon+1);
+      if(value != std::string::npos) return msg.c_str()+value;
+    }
+  }
+  return nullptr;
+}
+
+static std::string stringValue(const std::string &msg, const char *key) {
+  const char *v = findValue(msg, key);
+  if(!v || *v != '"') return "";
+  const char *end = strchr(v+1, '"');
+  return end ? std::string(v+1, end) : "";
+}
+
+static bool boolValue(const std::string &msg, const char *key, bool &value) {
+  const char *v = findValue(msg, key);
+  if(!v) return false;
+  if(strncmp(v, "true", 4) == 0) value = true;
+  else if(strncmp(v, "false", 5) == 0) value = false;
+  else return false;
+  return true;
+}
+
+// true if the get request's list of values asks for key
+static bool requests(const std::string &msg, const char *key) {
+  return msg.find(std::string("\"") + key + "\"") != std::string::npos;
+}
+
+static void updatePushCount(GazeServer *server, Client &c, bool push) {
+  if(c.push != push) server->pushClients += push ? 1 : -1;
+  c.push = push;
+}
+
+static void handleRequest(GazeServer *server, Client &c, const std::string &msg) {
+  std::string category = stringValue(msg, "category");
+  std::string request = stringValue(msg, "request");
+  std::string &reply = server->json;
+  reply.clear();
+  if(category == "heartbeat") {
+    reply = "{\"category\":\"heartbeat\",\"statuscode\":200}";
+  } else if(category == "tracker" && request == "set") {
+    bool push = c.push, binary = c.binary;
+    boolValue(msg, "push", push);
+    boolValue(msg, "binary", binary);
+    updatePushCount(server, c, push);
+    reply = "{\"category\":\"tracker\",\"request\":\"set\",\"statuscode\":200}";
+    // the reply is still in the client's old framing, everything after it in the new one
+    sendReply(c, reply);
+    c.binary = binary;
+    return;
+  } else if(category == "tracker" && request == "get") {
+    reply = "{\"category\":\"tracker\",\"request\":\"get\",\"statuscode\":200,\"values\":{";
+    size_t start = reply.size();
+    auto field = [&](const char *key, const std::string &value) {
+      if(!requests(msg, key)) return;
+      if(reply.size() > start) reply += ',';
+      reply += std::string("\"") + key + "\":" + value;
+    };
+    field("push", c.push ? "true" : "false");
+    field("heartbeatinterval", "3000");
+    field("version", "1");
+    field("trackerstate", "0"); // connected
+    field("framerate", std::to_string(kCaptureFPS));
+    field("iscalibrated", "false");
+    field("iscalibrating", "false");
+    reply += "}}";
+  } else {
+    appendf(reply, "{\"category\":\"%s\",\"request\":\"%s\",\"statuscode\":400,"
+                   "\"values\":{\"statusmessage\":\"not supported by SmartGaze\"}}",
+            category.substr(0, 64).c_str(), request.substr(0, 64).c_str());
+  }
+  sendReply(c, reply);
+}
+
+// Splits the input into top level JSON objects by matching braces outside of strings,
+// since Eye Tribe clients don't all separate requests with newlines.
+static bool handleInput(GazeServer *server, Client &c) {
+  std::string &in = c.input;
+  size_t start = 0, i = 0;
+  int depth = 0;
+  bool inString = false, escaped = false;
+  for(; i < in.size(); ++i) {
+    char ch = in[i];
+    if(inString) {
+      if(escaped) escaped = false;
+      else if(ch == '\\') escaped = true;
+      else if(ch == '"') inString = false;
+    } else if(ch == '"') {
+      inString = true;
+    } else if(ch == '{') {
+      if(depth++ == 0) start = i;
+    } else if(ch == '}' && depth > 0) {
+      if(--depth == 0) {
+        handleRequest(server, c, in.substr(start, i+1-start));
+        start = i+1;
+      }
+    } else if(depth == 0) {
+      start = i+1; // whitespace between messages
+    }
+  }
+  if(depth == 0) {
+    in.clear();
+  } else {
+    in.erase(0, start);
+  }
+  return in.size() <= kMaxRequestSize;
+}
+
+// --- connections ---
+
+static void setNonBlocking(int fd) {
+  fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+}
+
+static void watchWritable(GazeServer *server, Client &c, bool writable) {
+  if(c.waitingWritable == writable) return;
+  struct epoll_event ev;
+  ev.events = EPOLLIN | (writable ? (uint32_t)EPOLLOUT : 0u);
+  ev.data.fd = c.fd;
+  epoll_ctl(server->epollFd, EPOLL_CTL_MOD, c.fd, &ev);
+  c.waitingWritable = writable;
+}
+
+static void closeClient(GazeServer *server, int fd) {
+  auto it = server->clients.find(fd);
+  if(it == server->clients.end()) return;
+  updatePushCount(server, it->second, false);
+  if(it->second.framesSkipped)
+    fprintf(stderr, "gaze client disconnected, it skipped %" PRIu64 " frames by reading slowly\n", it->second.framesSkipped);
+  epoll_ctl(server->epollFd, EPOLL_CTL_DEL, fd, nullptr);
+  close(fd);
+  server->clients.erase(it);
+}
+
+// Writes as much output as the socket takes, false if the client is gone.
+static bool flushClient(GazeServer *server, Client &c) {
+  while(c.outputSent < c.output.size()) {
+    ssize_t n = send(c.fd, c.output.data()+c.outputSent, c.output.size()-c.outputSent, MSG_NOSIGNAL);
+    if(n < 0) {
+      if(errno == EINTR) continue;
+      if(errno == EAGAIN || errno == EWOULDBLOCK) break;
+      return false;
+    }
+    c.outputSent += n;
+  }
+  if(c.outputSent == c.output.size()) {
+    c.output.clear();
+    c.outputSent = 0;
+  } else if(c.outputSent > c.output.size()/2) {
+    c.output.erase(0, c.outputSent);
+    c.outputSent = 0;
+  }
+  size_t pending = c.output.size()-c.outputSent;
+  if(pending > kMaxStalledOutput) return false;
+  watchWritable(server, c, pending > 0);
+  return true;
+}
+
+static void acceptClients(GazeServer *server, int listenFd) {
+  while(true) {
+    int fd = accept(listenFd, nullptr, nullptr);
+    if(fd < 0) return;
+    setNonBlocking(fd);
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one)); // fails harmlessly on Unix sockets
+
+    Client &c = server->clients[fd];
+    c.fd = fd;
+    c.push = false;
+    c.binary = false;
+    c.waitingWritable = false;
+    c.outputSent = 0;
+    c.framesSkipped = 0;
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.fd = fd;
+    epoll_ctl(server->epollFd, EPOLL_CTL_ADD, fd, &ev);
+  }
+}
+
+static void readClient(GazeServer *server, Client &c) {
+  char buf[4096];
+  while(true) {
+    ssize_t n = recv(c.fd, buf, sizeof(buf), 0);
+    if(n == 0 || (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)) {
+      closeClient(server, c.fd);
+      return;
+    }
+    if(n < 0) {
+      if(errno == EINTR) continue;
+      break;
+    }
+    c.input.append(buf, n);
+  }
+  if(!handleInput(server, c) || !flushClient(server, c)) closeClient(server, c.fd);
+}
+
+// Formats each queued result once per framing and appends it to every push client that
+// keeps up, then does one write per client for the whole batch.
+static void pushResults(GazeServer *server) {
+  {
+    std::lock_guard<std::mutex> lock(server->queueMutex);
+    server->batch.clear();
+    std::swap(server->batch, server->queued);
+  }
+  std::string &json = server->json;
+  for(const TrackingResult &r : server->batch) {
+    json.clear();
+    for(auto &&kv : server->clients) {
+      Client &c = kv.second;
+      if(!c.push) continue;
+      if(c.output.size()-c.outputSent > kMaxPendingOutput) {
+        c.framesSkipped++;
+        continue;
+      }
+      if(c.binary) {
+        appendBinary(c.output, kBinaryResult, &r, sizeof(r));
+      } else {
+        if(json.empty()) formatFrame(json, r);
+        c.output += json;
+        c.output += '\n';
+      }
+    }
+  }
+
+  std::vector<int> gone;
+  for(auto &&kv : server->clients) {
+    Client &c = kv.second;
+    // clients waiting for EPOLLOUT get flushed when their socket drains
+    if(c.waitingWritable || c.output.empty()) continue;
+    if(!flushClient(server, c)) gone.push_back(kv.first);
+  }
+  for(int fd : gone) closeClient(server, fd);
+}
+
+static void serverLoop(GazeServer *server) {
+  struct epoll_event events[64];
+  while(!server->stopping) {
+    int n = epoll_wait(server->epollFd, events, 64, -1);
+    for(int i = 0; i < n; ++i) {
+      int fd = events[i].data.fd;
+      if(fd == server->wakeFd) {
+        uint64_t count;
+        if(read(fd, &count, sizeof(count)) < 0) {} // only resets the counter
+        pushResults(server);
+      } else if(fd == server->tcpFd || fd == server->unixFd) {
+        acceptClients(server, fd);
+      } else {
+        auto it = server->clients.find(fd);
+        if(it == server->clients.end()) continue;
+        Client &c = it->second;
+        if(events[i].events & (EPOLLHUP | EPOLLERR)) {
+          closeClient(server, fd);
+        } else if(events[i].events & EPOLLIN) {
+          readClient(server, c);
+        } else if(events[i].events & EPOLLOUT) {
+          if(!flushClient(server, c)) closeClient(server, fd);
+        }
+      }
+    }
+  }
+}
+
+static int listenTCP(int port) {
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  if(fd < 0) return -1;
+  int one = 1;
+  setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+  struct sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  if(bind(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0 || listen(fd, kListenBacklog) != 0) {
+    perror("gaze server TCP listen");
+    close(fd);
+    return -1;
+  }
+  setNonBlocking(fd);
+  return fd;
+}
+
+static int listenUnix(const char *path) {
+  struct sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  if(strlen(path) >= sizeof(addr.sun_path)) {
+    fprintf(stderr, "gaze server socket path too long: %s\n", path);
+    return -1;
+  }
+  strcpy(addr.sun_path, path);
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if(fd < 0) return -1;
+  unlink(path);
+  if(bind(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0 || listen(fd, kListenBacklog) != 0) {
+    perror("gaze server Unix socket listen");
+    close(fd);
+    return -1;
+  }
+  setNonBlocking(fd);
+  return fd;
+}
+
+GazeServer *createGazeServer(const GazeServerOptions &opts) {
+  int tcpFd = opts.tcpPort ? listenTCP(opts.tcpPort) : -1;
+  int unixFd = opts.unixPath ? listenUnix(opts.unixPath) : -1;
+  if((opts.tcpPort && tcpFd < 0) || (opts.unixPath && unixFd < 0) || (tcpFd < 0 && unixFd < 0)) {
+    if(tcpFd >= 0) close(tcpFd);
+    if(unixFd >= 0) close(unixFd);
+    return nullptr;
+  }
+
+  int epollFd = epoll_create1(0);
+  int wakeFd = eventfd(0, EFD_NONBLOCK);
+  bool ok = epollFd >= 0 && wakeFd >= 0;
+  if(!ok) perror("createGazeServer");
+  for(int fd : {wakeFd, tcpFd, unixFd}) {
+    if(!ok || fd < 0) continue;
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.fd = fd;
+    if(epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &ev) != 0) {
+      perror("epoll_ctl");
+      ok = false;
+    }
+  }
+  if(!ok) {
+    for(int fd : {epollFd, wakeFd, tcpFd, unixFd})
+      if(fd >= 0) close(fd);
+    if(unixFd >= 0) unlink(opts.unixPath);
+    return nullptr;
+  }
+
+  GazeServer *server = new GazeServer();
+  server->tcpFd = tcpFd;
+  server->unixFd = unixFd;
+  if(opts.unixPath) server->unixPath = opts.unixPath;
+  server->stopping = false;
+  server->pushClients = 0;
+  server->epollFd = epollFd;
+  server->wakeFd = wakeFd;
+  server->queued.reserve(kMaxQueuedResults);
+  server->batch.reserve(kMaxQueuedResults);
+  server->thread = std::thread(serverLoop, server);
+  return server;
+}
+
+static void wakeServer(GazeServer *server) {
+  uint64_t one = 1;
+  if(write(server->wakeFd, &one, sizeof(one)) < 0) {} // only fails if the counter is already huge
+}
+
+void serveResult(GazeServer *server, const TrackingResult &result) {
+  if(server->pushClients == 0) return;
+  bool wasEmpty;
+  {
+    std::lock_guard<std::mutex> lock(server->queueMutex);
+    wasEmpty = server->queued.empty();
+    if(server->queued.size() == kMaxQueuedResults) server->queued.erase(server->queued.begin());
+    server->queued.push_back(result);
+  }
+  // a non empty queue means the server thread has a wakeup pending already
+  if(wasEmpty) wakeServer(server);
+}
+
+void deleteGazeServer(GazeServer *server) {
+  server->stopping = true;
+  wakeServer(server);
+  server->thread.join();
+  for(auto &&kv : server->clients) close(kv.first);
+  if(server->tcpFd >= 0) close(server->tcpFd);
+  if(server->unixFd >= 0) {
+    close(server->unixFd);
+    unlink(server->unixPath.c_str());
+  }
+  close(server->wakeFd);
+  close(server->epollFd);
+  delete server;
+}
+
+#else
+
+// epoll is Linux only
+GazeServer *createGazeServer(const GazeServerOptions &opts) {
+  fprintf(stderr, "the gaze server is only available on Linux\n");
+  return nullptr;
+}
+void serveResult(GazeServer *server, const TrackingResult &result) {}
+void deleteGazeServer(GazeServer *server) {}
+
+#endif
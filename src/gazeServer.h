@@ -0,0 +1,54 @@
+// The SmartGaze Eye Tracker
+// Copyright (C) 2016  Tristan Hume
+// Released under GPLv2, see LICENSE file for full text
+#ifndef GAZESERVER_H__
+#define GAZESERVER_H__
+
+#include "trackingResult.h"
+
+#include <stdint.h>
+
+// Serves tracking results to local clients over TCP and/or a Unix socket, speaking the
+// tracker category of the Eye Tribe JSON API: clients turn on push with
+// {"category":"tracker","request":"set","values":{"push":true}} and then get a frame message per
+// tracked frame, with the usual heartbeat and get requests answered too. Since SmartGaze has no
+// calibration the gaze points are always 0, the eyes' pupil centers and sizes are filled in and
+// a "smartgaze" object in each frame carries the full result.
+//
+// Setting "binary":true along with push switches a client to binary framing: every message after
+// the reply is a BinaryMessageHeader followed by either a TrackingResult or the text of a JSON reply.
+//
+// The server runs on its own thread. Each client has a bounded output buffer, a client that falls
+// behind skips frames rather than holding up tracking or the other clients.
+
+static const char kBinaryMessageMagic[4] = {'S','G','T','R'};
+enum BinaryMessageType {
+  kBinaryResult = 1, // payload is a TrackingResult
+  kBinaryJson = 2,   // payload is a JSON reply to a request
+};
+struct BinaryMessageHeader {
+  char magic[4];
+  uint32_t type;
+  uint32_t length;  // payload bytes following the header
+  uint32_t version; // kTrackingResultVersion, check it before reading a TrackingResult payload
+};
+
+static const int kEyeTribePort = 6555;
+
+struct GazeServerOptions {
+  // listens on localhost when nonzero
+  int tcpPort;
+  // Unix socket path to listen on, replaced if it already exists
+  const char *unixPath;
+
+  GazeServerOptions() : tcpPort(0), unixPath(nullptr) {}
+};
+
+// Returns nullptr if no listening socket could be set up.
+struct GazeServer;
+GazeServer *createGazeServer(const GazeServerOptions &opts);
+// Queues a result for every push client, never blocks on clients. Call from one thread only.
+void serveResult(GazeServer *server, const TrackingResult &result);
+void deleteGazeServer(GazeServer *server);
+
+#endif
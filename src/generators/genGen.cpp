@@ -0,0 +1,11 @@
+// The SmartGaze Eye Tracker
+// Copyright (C) 2016  Tristan Hume
+// Released under GPLv2, see LICENSE file for full text
+
+// Command line driver that turns the registered generators into static libraries,
+// the same as Halide's tools/GenGen.cpp.
+#include "Halide.h"
+
+int main(int argc, char **argv) {
+  return Halide::Internal::generate_filter_main(argc, argv, std::cerr);
+}
@@ -0,0 +1,98 @@
+// The SmartGaze Eye Tracker
+// Copyright (C) 2016  Tristan Hume
+// Released under GPLv2, see LICENSE file for full text
+
+// Halide pipelines, compiled ahead of time by the build into one static library
+// per generator and CPU feature level. See halideFuncs.cpp for how they are called.
+
+#include "Halide.h"
+using namespace Halide;
+
+class GlintKernelGenerator : public Generator<GlintKernelGenerator> {
+  static const int kKernelOffset = 8;
+public:
+  ImageParam input{UInt(16), 2, "input"};
+  Var x, y;
+
+  Func build() {
+    // Define the Func.
+    Func clamped = BoundaryConditions::repeat_edge(input);
+    Func out;
+    Expr up = clamped(x,y-kKernelOffset);
+    out(x, y) = select(clamped(x, y)>up, Halide::cast<uint8_t>((clamped(x,y)-up)/10), Halide::cast<uint8_t>(0));
+
+    // Schedule it.
+    out.vectorize(x, 8).parallel(y);
+
+    return out;
+  }
+};
+
+class FindGlintsGenerator : public Generator<FindGlintsGenerator> {
+public:
+  static const int kBoxSize = 32;
+  static const int kThresh = 3;
+  ImageParam input{UInt(8), 2, "input"};
+  Var x, y;
+
+  Func build() {
+    // Define the Func.
+    RDom xr(0, kBoxSize);
+    RDom yr(0, kBoxSize);
+    Func out;
+
+    out(x, y) = select(sum(yr, sum(xr, input(x*kBoxSize+xr,y*kBoxSize+yr))) > kThresh, Halide::cast<uint8_t>(255), Halide::cast<uint8_t>(0));
+
+    out.vectorize(x, 16);
+
+    return out;
+  }
+};
+
+// Everything trackFrame does to the full frame before looking for glints, fused into one
+// pass over strips of rows: 2x2 box downscale, conversion to 8 bits, and the same mean
+// adaptive threshold as adaptiveThreshold(.., 255, ADAPTIVE_THRESH_MEAN_C, THRESH_BINARY_INV, 11, -40).
+// Outputs the half size 8 bit image and the glint mask, which is 0 on glints and 255 elsewhere.
+class FrontEndGenerator : public Generator<FrontEndGenerator> {
+public:
+  static const int kThreshRadius = 5;
+  static const int kThreshOffset = 40;
+  static const int kStripHeight = 32;
+  ImageParam input{UInt(16), 2, "input"};
+  Var x, y, yo, yi;
+
+  Func build() {
+    Expr halfWidth = input.width()/2;
+    Expr halfHeight = input.height()/2;
+
+    // 4 10 bit pixels summed and scaled by 1/4 for the downscale and 1/4 for 10 to 8 bits
+    Func gray("gray");
+    Expr sum4 = Halide::cast<uint16_t>(input(2*x,2*y)) + input(2*x+1,2*y) + input(2*x,2*y+1) + input(2*x+1,2*y+1);
+    gray(x, y) = Halide::cast<uint8_t>(min((sum4 + 8) / 16, 255));
+
+    Func clamped = BoundaryConditions::repeat_edge(gray, 0, halfWidth, 0, halfHeight);
+    RDom r(-kThreshRadius, 2*kThreshRadius+1);
+    Func rowSum("rowSum");
+    rowSum(x, y) = sum(Halide::cast<uint16_t>(clamped(x+r, y)));
+    Func boxSum("boxSum");
+    boxSum(x, y) = sum(rowSum(x, y+r));
+    const int area = (2*kThreshRadius+1)*(2*kThreshRadius+1);
+    Expr mean = Halide::cast<int16_t>((boxSum(x, y) + area/2) / area);
+
+    Func out("frontEnd");
+    Expr isGlint = Halide::cast<int16_t>(gray(x, y)) - mean > kThreshOffset;
+    out(x, y) = Tuple(gray(x, y), select(isGlint, Halide::cast<uint8_t>(0), Halide::cast<uint8_t>(255)));
+
+    // Schedule it: each strip computes the gray rows it needs plus the threshold apron
+    out.split(y, yo, yi, kStripHeight).parallel(yo).vectorize(x, 16);
+    gray.compute_at(out, yo).vectorize(x, 16);
+    rowSum.compute_at(out, yo).vectorize(x, 16);
+    boxSum.compute_at(out, yi).vectorize(x, 16);
+
+    return out;
+  }
+};
+
+RegisterGenerator<FrontEndGenerator> registerFrontEnd{"front_end"};
+RegisterGenerator<GlintKernelGenerator> registerGlintKernel{"glint_kernel"};
+RegisterGenerator<FindGlintsGenerator> registerFindGlints{"find_glints"};
@@ -0,0 +1,98 @@
+// The SmartGaze Eye Tracker
+// Copyright (C) 2016  Tristan Hume
+// Released under GPLv2, see LICENSE file for full text
+
+#include "glintFill.h"
+
+#include <assert.h>
+#include <string.h>
+
+// in half size pixels, covers the glint halo so it doesn't bleed into the fill
+static const int kGlintFillDilation = 2;
+
+using namespace cv;
+
+// Linear interpolation along one masked span [a,b) of a line of pixels given the values just outside it.
+// Writes the estimate and its weight for each pixel of the span, or leaves weight 0 if both ends are off the line.
+static inline void interpolateSpan(int a, int b, int n, int before, int after, float *value, float *weight) {
+  bool hasBefore = a > 0, hasAfter = b < n;
+  if(!hasBefore && !hasAfter) return;
+  float w = 1.0f/(b-a+1);
+  for(int k = a; k < b; ++k) {
+    float v;
+    if(hasBefore && hasAfter) {
+      float t = (float)(k-a+1)/(b-a+1);
+      v = before + (after-before)*t;
+    } else {
+      v = hasBefore ? before : after;
+    }
+    value[k] = v;
+    weight[k] = w;
+  }
+}
+
+void fillGlints(Mat &region, const Mat &glintMask, GlintFillBuffers &buffers) {
+  assert(region.type() == CV_8UC1 && glintMask.type() == CV_8UC1);
+  int rows = region.rows, cols = region.cols;
+
+  // build the full size mask from the glint pixels, dilated and upscaled in one go
+  Mat &mask = buffers.mask;
+  mask.create(region.size(), CV_8UC1);
+  mask = Scalar(0);
+  int minX = cols, minY = rows, maxX = 0, maxY = 0;
+  for(int i = 0; i < glintMask.rows; ++i) {
+    const uint8_t *Mi = glintMask.ptr<uint8_t>(i);
+    for(int j = 0; j < glintMask.cols; ++j) {
+      if(Mi[j] != 0) continue;
+      int x0 = std::max(0, (j-kGlintFillDilation)*2), x1 = std::min(cols, (j+kGlintFillDilation+1)*2);
+      int y0 = std::max(0, (i-kGlintFillDilation)*2), y1 = std::min(rows, (i+kGlintFillDilation+1)*2);
+      if(x0 >= x1 || y0 >= y1) continue;
+      for(int y = y0; y < y1; ++y)
+        memset(mask.ptr<uint8_t>(y)+x0, 255, x1-x0);
+      minX = std::min(minX, x0); maxX = std::max(maxX, x1);
+      minY = std::min(minY, y0); maxY = std::max(maxY, y1);
+    }
+  }
+  if(minX >= maxX) return; // no glints in this region
+
+  // horizontal estimates, only rows with glints can have masked spans
+  size_t size = (size_t)rows*cols;
+  if(buffers.value.size() < size) {
+    buffers.value.resize(size);
+    buffers.weight.resize(size);
+  }
+  float *value = buffers.value.data(), *weight = buffers.weight.data();
+  for(int i = minY; i < maxY; ++i) {
+    const uint8_t *Mi = mask.ptr<uint8_t>(i);
+    const uint8_t *Ri = region.ptr<uint8_t>(i);
+    float *Vi = value + i*cols, *Wi = weight + i*cols;
+    for(int j = minX; j < maxX; ++j) Wi[j] = 0;
+    for(int j = minX; j < maxX;) {
+      if(!Mi[j]) { ++j; continue; }
+      int a = j;
+      while(j < maxX && Mi[j]) ++j;
+      interpolateSpan(a, j, cols, a > 0 ? Ri[a-1] : 0, j < cols ? Ri[j] : 0, Vi, Wi);
+    }
+  }
+
+  // vertical estimates, blended with the horizontal ones and written straight back since
+  // spans only ever read clean pixels
+  buffers.columnValue.resize(rows);
+  buffers.columnWeight.resize(rows);
+  float *colValue = buffers.columnValue.data(), *colWeight = buffers.columnWeight.data();
+  for(int j = minX; j < maxX; ++j) {
+    for(int i = minY; i < maxY;) {
+      if(!mask.at<uint8_t>(i,j)) { ++i; continue; }
+      int a = i;
+      while(i < maxY && mask.at<uint8_t>(i,j)) ++i;
+      for(int k = a; k < i; ++k) colWeight[k] = 0;
+      interpolateSpan(a, i, rows, a > 0 ? region.at<uint8_t>(a-1,j) : 0, i < rows ? region.at<uint8_t>(i,j) : 0,
+                      colValue, colWeight);
+      for(int k = a; k < i; ++k) {
+        float wh = weight[k*cols+j], wv = colWeight[k];
+        if(wh + wv == 0) continue;
+        region.at<uint8_t>(k,j) = saturate_cast<uint8_t>((value[k*cols+j]*wh + colValue[k]*wv)/(wh+wv));
+      }
+    }
+  }
+}
@@ -0,0 +1,24 @@
+// The SmartGaze Eye Tracker
+// Copyright (C) 2016  Tristan Hume
+// Released under GPLv2, see LICENSE file for full text
+#ifndef GLINTFILL_H__
+#define GLINTFILL_H__
+
+#include <opencv2/imgproc/imgproc.hpp>
+#include <vector>
+
+// Scratch space for fillGlints, keep one per thread so filling doesn't allocate.
+struct GlintFillBuffers {
+  cv::Mat mask;               // full size, nonzero where pixels get replaced
+  std::vector<float> value;   // horizontal estimate for each masked pixel
+  std::vector<float> weight;
+  std::vector<float> columnValue, columnWeight; // vertical estimates for one column
+};
+
+// Blanks out the glints in an 8 bit eye region by interpolating across each masked span
+// from the nearest clean pixels, horizontally and vertically, weighting the shorter span more.
+// glintMask is the matching half size crop of the glint mask, 0 on glints. Only pixels near
+// glints are touched, a much cheaper stand-in for inpainting since glints are small and round.
+void fillGlints(cv::Mat &region, const cv::Mat &glintMask, GlintFillBuffers &buffers);
+
+#endif
@@ -0,0 +1,315 @@
+// The SmartGaze Eye Tracker
+// Copyright (C) 2016  Tristan Hume
+// Released under GPLv2, see LICENSE file for full text
+
+#include "glints.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+static const int kFirstGlintXShadow = 100;
+static const int kGlintNeighbourhood = 100;
+static const int kGlintIntensityRegionDist = 80;
+static const double kGlintRegionIntensityThresh = 240.0*(256.0/1024.0); // on the 8 bit image
+// half size of the window a tracked glint's anchor blob must be in around the prediction,
+// glints move a few pixels per frame at 60Hz
+static const int kGlintSearchRadius = 40;
+// alpha-beta filter gains for the position and velocity estimates
+static const float kTrackAlpha = 0.85f;
+static const float kTrackBeta = 0.3f;
+
+using namespace cv;
+
+// appends the runs of glint (zero) pixels in a row of n pixels
+static void findRuns(const uint8_t *row, int n, int offset, std::vector<GlintLabeller::Run> &runs) {
+  int start = -1;
+  int j = 0;
+#ifdef __SSE2__
+  // most of the mask is background, check 16 pixels at a time for any change
+  const __m128i zero = _mm_setzero_si128();
+  for(; j+16 <= n; j += 16) {
+    unsigned set = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(row+j)), zero));
+    if(set == (start < 0 ? 0u : 0xFFFFu)) continue;
+    for(int k = 0; k < 16; ++k) {
+      bool isGlint = (set >> k) & 1;
+      if(isGlint && start < 0) {
+        start = j+k;
+      } else if(!isGlint && start >= 0) {
+        runs.push_back({start+offset, j+k+offset, -1});
+        start = -1;
+      }
+    }
+  }
+#endif
+  for(; j < n; ++j) {
+    bool isGlint = (row[j] == 0);
+    if(isGlint && start < 0) {
+      start = j;
+    } else if(!isGlint && start >= 0) {
+      runs.push_back({start+offset, j+offset, -1});
+      start = -1;
+    }
+  }
+  if(start >= 0) runs.push_back({start+offset, n+offset, -1});
+}
+
+int GlintLabeller::find(int l) {
+  while(labels[l].parent != l) {
+    labels[l].parent = labels[labels[l].parent].parent;
+    l = labels[l].parent;
+  }
+  return l;
+}
+
+void GlintLabeller::merge(int a, int b) {
+  a = find(a);
+  b = find(b);
+  if(a == b) return;
+  // the earlier label always starts first in raster order, so it stays the root
+  if(b < a) std::swap(a, b);
+  Label &la = labels[a];
+  const Label &lb = labels[b];
+  labels[b].parent = a;
+  la.area += lb.area;
+  la.weight += lb.weight;
+  la.xSum += lb.xSum;
+  la.ySum += lb.ySum;
+  la.minX = std::min(la.minX, lb.minX);
+  la.minY = std::min(la.minY, lb.minY);
+  la.maxX = std::max(la.maxX, lb.maxX);
+  la.maxY = std::max(la.maxY, lb.maxY);
+}
+
+void GlintLabeller::label(const Mat &mask, const Mat &gray, Rect roi, std::vector<GlintBlob> &blobs) {
+  labels.clear();
+  std::vector<Run> *prev = &runs[0], *cur = &runs[1];
+  prev->clear();
+  for(int i = roi.y; i < roi.y+roi.height; ++i) {
+    cur->clear();
+    findRuns(mask.ptr<uint8_t>(i)+roi.x, roi.width, roi.x, *cur);
+    const uint8_t *Gi = gray.ptr<uint8_t>(i);
+    size_t p = 0;
+    for(Run &run : *cur) {
+      // runs in the row above touch this one (diagonals included) if they overlap [start-1,end]
+      while(p < prev->size() && (*prev)[p].end < run.start) ++p;
+      for(size_t q = p; q < prev->size() && (*prev)[q].start <= run.end; ++q) {
+        int above = (*prev)[q].label;
+        if(above < 0) continue;
+        if(run.label < 0) {
+          run.label = find(above);
+        } else {
+          merge(run.label, above);
+          run.label = find(run.label);
+        }
+      }
+      if(run.label < 0) {
+        run.label = labels.size();
+        Label l;
+        l.parent = run.label;
+        l.area = 0;
+        l.weight = l.xSum = l.ySum = 0;
+        l.minX = run.start; l.maxX = run.end-1;
+        l.minY = l.maxY = i;
+        l.first = Point(run.start, i);
+        labels.push_back(l);
+      }
+
+      int64_t weight = 0, xSum = 0;
+      for(int j = run.start; j < run.end; ++j) {
+        int w = Gi[j]+1; // +1 so a black glint pixel still counts
+        weight += w;
+        xSum += w*j;
+      }
+      Label &l = labels[run.label];
+      l.area += run.end-run.start;
+      l.weight += weight;
+      l.xSum += xSum;
+      l.ySum += weight*i;
+      l.minX = std::min(l.minX, run.start);
+      l.maxX = std::max(l.maxX, run.end-1);
+      l.maxY = i;
+    }
+    std::swap(prev, cur);
+  }
+
+  // roots are already in raster order of their first pixel since labels are made in that order
+  for(int l = 0; l < (int)labels.size(); ++l) {
+    const Label &la = labels[l];
+    if(la.parent != l) continue;
+    GlintBlob blob;
+    blob.area = la.area;
+    blob.weight = la.weight;
+    blob.centroid = Point2f((double)la.xSum/la.weight, (double)la.ySum/la.weight);
+    blob.bounds = Rect(la.minX, la.minY, la.maxX-la.minX+1, la.maxY-la.minY+1);
+    blob.first = la.first;
+    blobs.push_back(blob);
+  }
+}
+
+void GlintIntegrals::reset(const Mat &gray) {
+  this->gray = &gray;
+  cols = gray.cols;
+  stride = cols+1;
+  size_t size = (size_t)(gray.rows+1)*stride;
+  // row 0 stays zero forever
+  if(intensity.size() != size) intensity.assign(size, 0);
+  intensityRows = 0;
+}
+
+void GlintIntegrals::integrateIntensity(int rows) {
+  rows = std::min(rows, gray->rows);
+  for(; intensityRows < rows; ++intensityRows) {
+    int i = intensityRows;
+    const uint8_t *Gi = gray->ptr<uint8_t>(i);
+    const int32_t *above = &intensity[i*stride];
+    int32_t *out = &intensity[(i+1)*stride];
+    int32_t rowSum = 0;
+    for(int j = 0; j < cols; j++) {
+      rowSum += Gi[j];
+      out[j+1] = above[j+1] + rowSum;
+    }
+  }
+}
+
+int32_t GlintIntegrals::intensitySum(int x0, int y0, int x1, int y1) const {
+  return intensity[y1*stride+x1] - intensity[y0*stride+x1] - intensity[y1*stride+x0] + intensity[y0*stride+x0];
+}
+
+// find the average intensity above and beside a point
+double findLocalIntensity(GlintIntegrals &integrals, Point p, int size) {
+  int x0 = std::max(0,p.x-size), x1 = std::min(integrals.width(),p.x+size);
+  int y0 = std::max(0,p.y-size), y1 = p.y;
+  int numPixels = (x1-x0)*(y1-y0);
+  if(numPixels <= 0) return -1.0;
+  integrals.integrateIntensity(y1);
+  return ((double)(integrals.intensitySum(x0, y0, x1, y1)))/numPixels;
+}
+
+// Glints off dark hair or glasses frames have a dark neighbourhood, eye glints have lit skin above them.
+static bool inDarkRegion(GlintIntegrals &integrals, Point p) {
+  double avgIntensity = findLocalIntensity(integrals, p, kGlintIntensityRegionDist);
+  return avgIntensity >= 0 && avgIntensity < kGlintRegionIntensityThresh;
+}
+
+// intensity weighted mean of the blobs centred in the box around p, false if there are none.
+// Both modes centre a glint this way with size kGlintNeighbourhood around its anchor blob's first pixel.
+static bool findLocalCenter(const GlintBlob *begin, const GlintBlob *end, Point p, int size, Point2f &center) {
+  double weight = 0, x = 0, y = 0;
+  for(const GlintBlob *b = begin; b != end; ++b) {
+    if(b->centroid.x < p.x-size || b->centroid.x >= p.x+size ||
+       b->centroid.y < p.y-size || b->centroid.y >= p.y+size) continue;
+    weight += b->weight;
+    x += b->weight*b->centroid.x;
+    y += b->weight*b->centroid.y;
+  }
+  if(weight == 0) return false;
+  center = Point2f(x/weight, y/weight);
+  return true;
+}
+
+static std::vector<Point2f> scanGlints(GlintTracker &tracker, Mat &m, Mat &gray) {
+  GlintIntegrals &integrals = tracker.integrals;
+  integrals.reset(gray);
+  tracker.blobs.clear();
+  tracker.labeller.label(m, gray, Rect(0,0,m.cols,m.rows), tracker.blobs);
+
+  // take the first two blobs separated sufficiently horizontally, from the top
+  // so that glints off of teeth and headphones are ignored.
+  std::vector<Point> firsts;
+  for(const GlintBlob &blob : tracker.blobs) {
+    Point pt = blob.first;
+    if(!firsts.empty() && std::abs(pt.x - firsts[0].x) <= kFirstGlintXShadow) {
+      continue; // skip blobs too close to the first one
+    }
+    if(inDarkRegion(integrals, pt)) continue; // probably glint off dark hair
+    firsts.push_back(pt);
+    if(firsts.size() >= 2) break;
+  }
+
+  // Make the found point more centered on the eye instead of being just the first blob
+  const GlintBlob *blobs = tracker.blobs.data();
+  std::vector<Point2f> result;
+  for(Point p : firsts) {
+    Point2f center;
+    if(findLocalCenter(blobs, blobs+tracker.blobs.size(), p, kGlintNeighbourhood, center))
+      result.push_back(center);
+  }
+
+  // consistent order, purely so debug views aren't jittery
+  std::sort(result.begin(), result.end(), [](Point2f a, Point2f b) {
+      return a.x < b.x;
+  });
+
+  return result;
+}
+
+// Looks for both glints near their predicted positions, fails if either is missing. Each glint is
+// anchored on the first blob near its prediction that passes the same dark region check as the scan
+// and centred over the same neighbourhood, so a glint doesn't jump when tracking falls back to a scan.
+// Only the part of the mask those neighbourhoods can reach is labelled.
+static bool followGlints(GlintTracker &tracker, Mat &m, Mat &gray, std::vector<Point2f> &result) {
+  result.clear();
+  tracker.blobs.clear();
+  tracker.integrals.reset(gray);
+  Point predicted[2];
+  Rect area;
+  for(int g = 0; g < 2; ++g) {
+    Point2f p = tracker.position[g] + tracker.velocity[g];
+    predicted[g] = Point(cvRound(p.x), cvRound(p.y));
+    int reach = kGlintSearchRadius + kGlintNeighbourhood;
+    Rect around(predicted[g].x-reach, predicted[g].y-reach, reach*2, reach*2);
+    area = (g == 0) ? around : (area | around);
+  }
+  tracker.labeller.label(m, gray, area & Rect(0,0,m.cols,m.rows), tracker.blobs);
+  const GlintBlob *begin = tracker.blobs.data(), *end = begin + tracker.blobs.size();
+
+  for(int g = 0; g < 2; ++g) {
+    Point p = predicted[g];
+    const GlintBlob *anchor = nullptr;
+    for(const GlintBlob *b = begin; b != end && !anchor; ++b) {
+      if(std::abs(b->centroid.x - p.x) > kGlintSearchRadius || std::abs(b->centroid.y - p.y) > kGlintSearchRadius) continue;
+      if(inDarkRegion(tracker.integrals, b->first)) continue;
+      anchor = b;
+    }
+    Point2f center;
+    if(!anchor || !findLocalCenter(begin, end, anchor->first, kGlintNeighbourhood, center)) return false;
+    result.push_back(center);
+  }
+  // the windows drifted onto the same glint
+  if(std::abs(result[1].x - result[0].x) <= kFirstGlintXShadow) return false;
+  return result[0].x < result[1].x;
+}
+
+static void updateTracker(GlintTracker &tracker, const std::vector<Point2f> &glints, bool fromScan) {
+  if(glints.size() != 2) {
+    tracker.tracking = false;
+    return;
+  }
+  for(int g = 0; g < 2; ++g) {
+    Point2f measured = glints[g];
+    if(fromScan) {
+      // a fresh lock, no motion history yet
+      tracker.position[g] = measured;
+      tracker.velocity[g] = Point2f(0,0);
+    } else {
+      Point2f predicted = tracker.position[g] + tracker.velocity[g];
+      Point2f residual = measured - predicted;
+      tracker.position[g] = predicted + Point2f(residual.x*kTrackAlpha, residual.y*kTrackAlpha);
+      tracker.velocity[g] = tracker.velocity[g] + Point2f(residual.x*kTrackBeta, residual.y*kTrackBeta);
+    }
+  }
+  tracker.tracking = true;
+}
+
+std::vector<Point2f> trackGlints(GlintTracker &tracker, Mat &m, Mat &gray) {
+  std::vector<Point2f> found;
+  if(tracker.temporal && tracker.tracking && followGlints(tracker, m, gray, found)) {
+    updateTracker(tracker, found, false);
+  } else {
+    // lost track, fall back to searching the whole frame
+    found = scanGlints(tracker, m, gray);
+    updateTracker(tracker, found, true);
+  }
+  return found;
+}
@@ -0,0 +1,88 @@
+// The SmartGaze Eye Tracker
+// Copyright (C) 2016  Tristan Hume
+// Released under GPLv2, see LICENSE file for full text
+#ifndef GLINTS_H__
+#define GLINTS_H__
+
+#include <opencv2/imgproc/imgproc.hpp>
+#include <stdint.h>
+#include <vector>
+
+// A connected group of glint pixels in the glint mask.
+struct GlintBlob {
+  int area;
+  float weight;         // summed gray intensity
+  cv::Point2f centroid; // intensity weighted, subpixel
+  cv::Rect bounds;
+  cv::Point first;      // first pixel in raster order
+};
+
+// Labels the glint pixels (0 in the mask) of a region in one pass over its rows using
+// 8-connected runs. Blobs come out ordered by their first pixel in raster order and
+// in full mask coordinates. Keeps its buffers between calls so labelling doesn't allocate.
+class GlintLabeller {
+public:
+  struct Run {
+    int start, end; // [start,end) columns
+    int label;
+  };
+  void label(const cv::Mat &mask, const cv::Mat &gray, cv::Rect roi, std::vector<GlintBlob> &blobs);
+private:
+  struct Label {
+    int parent;
+    int area;
+    int64_t weight, xSum, ySum;
+    int minX, minY, maxX, maxY;
+    cv::Point first;
+  };
+  std::vector<Run> runs[2];
+  std::vector<Label> labels;
+  int find(int l);
+  void merge(int a, int b);
+};
+
+// Summed area table over the gray image for the dark region check glints have to pass.
+// Rows are only integrated once a check needs them, so glints near the top of the frame
+// don't pay for the rest.
+class GlintIntegrals {
+  int cols;
+  int stride;
+  int intensityRows; // rows of gray integrated so far
+  const cv::Mat *gray;
+  // (rows+1) x (cols+1), rows past the ones integrated so far hold stale sums from earlier frames
+  std::vector<int32_t> intensity;
+public:
+  GlintIntegrals() : cols(0), stride(0), intensityRows(0), gray(nullptr) {}
+  void reset(const cv::Mat &gray);
+  int width() const { return cols; }
+  void integrateIntensity(int rows);
+
+  // sum over [x0,x1)x[y0,y1), the rows must have been integrated
+  int32_t intensitySum(int x0, int y0, int x1, int y1) const;
+};
+
+// Follows the two eye glints from frame to frame so that steady tracking only has to
+// look around where a constant velocity model predicts them to be.
+struct GlintTracker {
+  bool temporal; // when false every frame is a full scan
+  bool tracking;
+  cv::Point2f position[2];
+  cv::Point2f velocity[2];
+  std::vector<GlintBlob> blobs; // every blob labelled this frame
+  GlintLabeller labeller;
+  GlintIntegrals integrals;
+
+  GlintTracker() : temporal(true), tracking(false) {}
+  void reset() { tracking = false; }
+};
+
+// Finds the eye glints in a glint mask (0 on glints) with gray being the matching 8 bit image,
+// ordered left to right, at their subpixel centers. When the tracker is temporal it searches
+// around the previous positions first and only scans the whole mask when that fails.
+std::vector<cv::Point2f> trackGlints(GlintTracker &tracker, cv::Mat &m, cv::Mat &gray);
+
+// Average of gray in the size*2 wide, size tall box above p in constant time,
+// or -1 if p is on the top row and there is nothing above it.
+double findLocalIntensity(GlintIntegrals &integrals, cv::Point p, int size);
+
+#endif
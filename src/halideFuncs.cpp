@@ -4,96 +4,130 @@
 
 #include "halideFuncs.h"
 
-#include "Halide.h"
-using namespace Halide;
-
-
-// template <class T> class MyGenerator : public Halide::Generator<T> {
-// };
-
-// class GlintKernelGenerator : public Generator<GlintKernelGenerator> {
-class GlintKernelGenerator {
-  static const int kKernelOffset = 8;
-public:
-  ImageParam input{UInt(16), 2, "input"};
-  Var x, y;
-
-  Func build() {
-    // Define the Func.
-    Func clamped = BoundaryConditions::repeat_edge(input);
-    Func out;
-    Expr up = clamped(x,y-kKernelOffset);
-    out(x, y) = select(clamped(x, y)>up, Halide::cast<uint8_t>((clamped(x,y)-up)/10), Halide::cast<uint8_t>(0));
-
-    // Schedule it.
-    out.vectorize(x, 8).parallel(y);
-
-    return out;
-  }
-};
-
-class FindGlintsGenerator {
-public:
-  static const int kBoxSize = 32;
-  static const int kThresh = 3;
-  ImageParam input{UInt(8), 2, "input"};
-  Var x, y;
-
-  Func build() {
-    // Define the Func.
-    RDom xr(0, kBoxSize);
-    RDom yr(0, kBoxSize);
-    Func out;
-
-    out(x, y) = select(sum(yr, sum(xr, input(x*kBoxSize+xr,y*kBoxSize+yr))) > kThresh, Halide::cast<uint8_t>(255), Halide::cast<uint8_t>(0));
-
-    out.vectorize(x, 16);
-
-    return out;
-  }
-};
+#include <assert.h>
+#include <atomic>
+#include <stdio.h>
+#include <string.h>
+
+// The pipelines in generators/halideGenerators.cpp are compiled by the build, once
+// per CPU feature level on x86-64, and we pick the best one the CPU supports at startup.
+#include "HalideRuntime.h"
+#ifdef SMARTGAZE_HALIDE_HOST_ONLY
+#include "front_end_host.h"
+#include "glint_kernel_host.h"
+#include "find_glints_host.h"
+#else
+#include "front_end_baseline.h"
+#include "front_end_sse41.h"
+#include "front_end_avx2.h"
+#include "front_end_avx512.h"
+#include "glint_kernel_baseline.h"
+#include "glint_kernel_sse41.h"
+#include "glint_kernel_avx2.h"
+#include "glint_kernel_avx512.h"
+#include "find_glints_baseline.h"
+#include "find_glints_sse41.h"
+#include "find_glints_avx2.h"
+#include "find_glints_avx512.h"
+#endif
+
+// must match FindGlintsGenerator::kBoxSize
+static const int kFindGlintsBoxSize = 32;
+
+typedef int (*FrontEndFunc)(buffer_t *input, buffer_t *gray, buffer_t *glintMask);
+typedef int (*ImageFunc)(buffer_t *input, buffer_t *output);
 
 struct HalideGens {
-  GlintKernelGenerator glintKernelGen;
-  Func glintKernelFunc;
-
-  FindGlintsGenerator findGlintsGen;
-  Func findGlintsFunc;
-
-  HalideGens() {
-    findGlintsFunc = findGlintsGen.build();
-    findGlintsFunc.compile_jit();
-    glintKernelFunc = glintKernelGen.build();
-    glintKernelFunc.compile_jit();
-  }
+  const char *variant;
+  FrontEndFunc frontEnd;
+  ImageFunc glintKernel;
+  ImageFunc findGlints;
 };
 
 HalideGens *createGens() {
-  return new HalideGens();
+  HalideGens *gens = new HalideGens();
+#ifdef SMARTGAZE_HALIDE_HOST_ONLY
+  gens->variant = "host";
+  gens->frontEnd = front_end_host;
+  gens->glintKernel = glint_kernel_host;
+  gens->findGlints = find_glints_host;
+#else
+  // every feature the variant's Halide target in CMakeLists.txt enables has to be checked,
+  // or its code dies with SIGILL on CPUs that have most but not all of them
+  __builtin_cpu_init();
+  bool avx2 = __builtin_cpu_supports("sse4.1") && __builtin_cpu_supports("avx") && __builtin_cpu_supports("f16c") &&
+              __builtin_cpu_supports("fma") && __builtin_cpu_supports("avx2");
+  if(avx2 && __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512cd") &&
+     __builtin_cpu_supports("avx512bw") && __builtin_cpu_supports("avx512dq") && __builtin_cpu_supports("avx512vl")) {
+    gens->variant = "avx512";
+    gens->frontEnd = front_end_avx512;
+    gens->glintKernel = glint_kernel_avx512;
+    gens->findGlints = find_glints_avx512;
+  } else if(avx2) {
+    gens->variant = "avx2";
+    gens->frontEnd = front_end_avx2;
+    gens->glintKernel = glint_kernel_avx2;
+    gens->findGlints = find_glints_avx2;
+  } else if(__builtin_cpu_supports("sse4.1")) {
+    gens->variant = "sse41";
+    gens->frontEnd = front_end_sse41;
+    gens->glintKernel = glint_kernel_sse41;
+    gens->findGlints = find_glints_sse41;
+  } else {
+    // plain x86-64, SSE2 only
+    gens->variant = "baseline";
+    gens->frontEnd = front_end_baseline;
+    gens->glintKernel = glint_kernel_baseline;
+    gens->findGlints = find_glints_baseline;
+  }
+#endif
+  // every tracking context picks the same pipelines, so only say which once
+  static std::atomic<bool> announced(false);
+  if(!announced.exchange(true)) printf("Using %s Halide pipelines\n", gens->variant);
+  return gens;
 }
 void deleteGens(HalideGens *gens) {
   delete gens;
 }
 
-static cv::Mat runFunc(Func &f, ImageParam &inParam, cv::Mat &m, cv::Size outSize) {
-  assert(m.isContinuous());
-
-  inParam.set(Buffer(UInt(m.elemSize()*8), m.cols, m.rows, 0, 0, m.ptr()));
+static buffer_t matBuffer(cv::Mat &m) {
+  buffer_t buf;
+  memset(&buf, 0, sizeof(buf));
+  buf.host = m.ptr();
+  buf.extent[0] = m.cols;
+  buf.extent[1] = m.rows;
+  buf.stride[0] = 1;
+  buf.stride[1] = m.step1();
+  buf.elem_size = m.elemSize();
+  return buf;
+}
 
+static cv::Mat runFunc(ImageFunc f, cv::Mat &m, cv::Size outSize) {
   cv::Mat out(outSize, CV_8UC1);
-  Image<uint8_t> output(Buffer(UInt(8), out.cols, out.rows, 0, 0, out.ptr()));
-  f.realize(output);
-
+  buffer_t inBuf = matBuffer(m);
+  buffer_t outBuf = matBuffer(out);
+  f(&inBuf, &outBuf);
   return out;
 }
 
+void frontEnd(HalideGens *gens, cv::Mat &m, cv::Mat &gray, cv::Mat &glintMask) {
+  assert(m.type() == CV_16UC1);
+  cv::Size outSize(m.cols/2, m.rows/2);
+  gray.create(outSize, CV_8UC1);
+  glintMask.create(outSize, CV_8UC1);
+  buffer_t inBuf = matBuffer(m);
+  buffer_t grayBuf = matBuffer(gray);
+  buffer_t maskBuf = matBuffer(glintMask);
+  gens->frontEnd(&inBuf, &grayBuf, &maskBuf);
+}
+
 cv::Mat glintKernel(HalideGens *gens, cv::Mat &m) {
   assert(m.type() == CV_16UC1);
-  return runFunc(gens->glintKernelFunc, gens->glintKernelGen.input, m, m.size());
+  return runFunc(gens->glintKernel, m, m.size());
 }
 
 cv::Mat findGlints(HalideGens *gens, cv::Mat &m) {
   assert(m.type() == CV_8UC1);
-  cv::Size outSize(m.cols/FindGlintsGenerator::kBoxSize, m.rows/FindGlintsGenerator::kBoxSize);
-  return runFunc(gens->findGlintsFunc, gens->findGlintsGen.input, m, outSize);
+  cv::Size outSize(m.cols/kFindGlintsBoxSize, m.rows/kFindGlintsBoxSize);
+  return runFunc(gens->findGlints, m, outSize);
 }
@@ -8,5 +8,7 @@ struct HalideGens;
 HalideGens *createGens();
 void deleteGens(HalideGens *gens);
 
+// Downscales a full 16 bit frame to a half size 8 bit image and thresholds it into a glint mask in one pass.
+void frontEnd(HalideGens *gens, cv::Mat &m, cv::Mat &gray, cv::Mat &glintMask);
 cv::Mat glintKernel(HalideGens *gens, cv::Mat &m);
 cv::Mat findGlints(HalideGens *gens, cv::Mat &m);
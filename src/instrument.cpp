@@ -0,0 +1,160 @@
+// The SmartGaze Eye Tracker
+// Copyright (C) 2016  Tristan Hume
+// Released under GPLv2, see LICENSE file for full text
+
+#include "instrument.h"
+
+#ifdef SMARTGAZE_INSTRUMENTATION
+
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <vector>
+
+static const char *const kStageNames[kNumStages] = {
+  "frame", "front end", "glints", "eye region", "glint removal", "pupil",
+  "seed", "edges", "ransac", "candidates", "refine", "queue wait", "capture to result",
+};
+
+// Log-linear buckets like HdrHistogram: values below 2^kSubBits nanoseconds get a bucket each,
+// above that every power of two is split into 2^kSubBits buckets, so any bucket is within 3%.
+static const int kSubBits = 5;
+static const int kSubBuckets = 1 << kSubBits;
+static const int kNumBuckets = (64-kSubBits+1)*kSubBuckets;
+// recent events kept per thread for trace dumps, a few seconds of frames
+static const int kTraceEvents = 1 << 14;
+
+static int bucketOf(uint64_t ns) {
+  if(ns < (uint64_t)kSubBuckets) return ns;
+  int msb = 63 - __builtin_clzll(ns);
+  int shift = msb - kSubBits;
+  return (shift+1)*kSubBuckets + ((ns >> shift) & (kSubBuckets-1));
+}
+
+// the middle of a bucket's range
+static double bucketValue(int bucket) {
+  if(bucket < kSubBuckets) return bucket;
+  int shift = bucket/kSubBuckets - 1;
+  uint64_t low = (uint64_t)(kSubBuckets + bucket%kSubBuckets) << shift;
+  return low + ((uint64_t)1 << shift)/2.0;
+}
+
+struct TraceEvent {
+  int64_t start, duration;
+  Stage stage;
+};
+
+// Only its own thread writes to it, reports read the counters with relaxed loads while it runs.
+struct ThreadStats {
+  int id;
+  std::atomic<uint64_t> counts[kNumStages][kNumBuckets];
+  std::atomic<uint64_t> maxNs[kNumStages];
+  TraceEvent trace[kTraceEvents];
+  std::atomic<uint64_t> traceHead; // events ever recorded, the latest is at (traceHead-1) % kTraceEvents
+};
+
+static std::mutex registryMutex;
+static std::vector<ThreadStats*> registry; // threads are never unregistered, their counts stay in the reports
+static const int64_t processStart = StageTimer::now();
+// totals as of the last report, so each report covers only the time since the previous one
+static uint64_t reported[kNumStages][kNumBuckets];
+
+static ThreadStats *threadStats() {
+  static thread_local ThreadStats *stats = nullptr;
+  if(stats) return stats;
+  stats = new ThreadStats();
+  for(int s = 0; s < kNumStages; ++s) {
+    for(int b = 0; b < kNumBuckets; ++b) stats->counts[s][b].store(0, std::memory_order_relaxed);
+    stats->maxNs[s].store(0, std::memory_order_relaxed);
+  }
+  stats->traceHead.store(0, std::memory_order_relaxed);
+  std::lock_guard<std::mutex> lock(registryMutex);
+  stats->id = registry.size();
+  registry.push_back(stats);
+  return stats;
+}
+
+StageTimer::~StageTimer() {
+  recordStageTime(stage, start, now());
+}
+
+void recordStageTime(Stage stage, int64_t start, int64_t end) {
+  uint64_t ns = std::max<int64_t>(end - start, 0);
+  ThreadStats *stats = threadStats();
+  // single writer, so plain load and store instead of a locked add
+  std::atomic<uint64_t> &count = stats->counts[stage][bucketOf(ns)];
+  count.store(count.load(std::memory_order_relaxed)+1, std::memory_order_relaxed);
+  if(ns > stats->maxNs[stage].load(std::memory_order_relaxed)) stats->maxNs[stage].store(ns, std::memory_order_relaxed);
+
+  uint64_t head = stats->traceHead.load(std::memory_order_relaxed);
+  TraceEvent &ev = stats->trace[head % kTraceEvents];
+  ev.start = start;
+  ev.duration = ns;
+  ev.stage = stage;
+  stats->traceHead.store(head+1, std::memory_order_release);
+}
+
+static double percentile(const uint64_t *counts, uint64_t total, double p) {
+  uint64_t rank = std::max<uint64_t>(1, (uint64_t)(p*total + 0.5));
+  uint64_t seen = 0;
+  for(int b = 0; b < kNumBuckets; ++b) {
+    seen += counts[b];
+    if(seen >= rank) return bucketValue(b);
+  }
+  return 0;
+}
+
+void printStageReport(FILE *f) {
+  std::lock_guard<std::mutex> lock(registryMutex);
+  fprintf(f, "%-17s %8s %10s %10s %10s %10s\n", "stage", "count", "p50 us", "p99 us", "p99.9 us", "max us");
+  std::vector<uint64_t> window(kNumBuckets);
+  for(int s = 0; s < kNumStages; ++s) {
+    uint64_t total = 0, maxNs = 0;
+    for(int b = 0; b < kNumBuckets; ++b) {
+      uint64_t sum = 0;
+      for(ThreadStats *t : registry) sum += t->counts[s][b].load(std::memory_order_relaxed);
+      window[b] = sum - reported[s][b];
+      reported[s][b] = sum;
+      total += window[b];
+    }
+    if(total == 0) continue;
+    // the max is over the whole run, per thread maxima can't be windowed without writer resets
+    for(ThreadStats *t : registry) maxNs = std::max(maxNs, (uint64_t)t->maxNs[s].load(std::memory_order_relaxed));
+    fprintf(f, "%-17s %8llu %10.1f %10.1f %10.1f %10.1f\n", kStageNames[s], (unsigned long long)total,
+            percentile(window.data(), total, 0.5)/1000, percentile(window.data(), total, 0.99)/1000,
+            percentile(window.data(), total, 0.999)/1000, maxNs/1000.0);
+  }
+  fflush(f);
+}
+
+bool writeStageTrace(const char *path) {
+  FILE *f = fopen(path, "w");
+  if(!f) {
+    perror("writeStageTrace");
+    return false;
+  }
+  std::vector<ThreadStats*> threads;
+  {
+    std::lock_guard<std::mutex> lock(registryMutex);
+    threads = registry;
+  }
+  fprintf(f, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+  bool first = true;
+  for(ThreadStats *t : threads) {
+    uint64_t head = t->traceHead.load(std::memory_order_acquire);
+    // the thread keeps recording while this runs, so leave the oldest quarter of the ring alone
+    // as it is what gets overwritten next
+    uint64_t begin = head > kTraceEvents*3/4 ? head - kTraceEvents*3/4 : 0;
+    for(uint64_t i = begin; i < head; ++i) {
+      TraceEvent ev = t->trace[i % kTraceEvents];
+      fprintf(f, "%s{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f}", first ? "" : ",\n",
+              kStageNames[ev.stage], t->id, (ev.start - processStart)/1000.0, ev.duration/1000.0);
+      first = false;
+    }
+  }
+  fprintf(f, "\n]}\n");
+  fclose(f);
+  return true;
+}
+
+#endif
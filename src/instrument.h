@@ -0,0 +1,67 @@
+// The SmartGaze Eye Tracker
+// Copyright (C) 2016  Tristan Hume
+// Released under GPLv2, see LICENSE file for full text
+#ifndef INSTRUMENT_H__
+#define INSTRUMENT_H__
+
+#include <stdint.h>
+#include <stdio.h>
+
+// Timing of the tracking stages. INSTRUMENT_STAGE(stage) times the rest of the enclosing scope into
+// a histogram owned by the calling thread, so recording never contends, and into a ring of recent
+// events for trace dumps. Building without SMARTGAZE_INSTRUMENTATION compiles all of it away.
+
+enum Stage {
+  kStageFrame,        // all of trackFrame
+  kStageFrontEnd,     // downscale and glint mask
+  kStageGlints,
+  kStageEyeRegion,    // cropping, 8 bit conversion and blur of one eye
+  kStageGlintRemoval,
+  kStagePupil,        // all of findEllipseStarburst
+  kStageSeed,
+  kStageEdges,        // starburst rays and edge filtering
+  kStageRansac,
+  kStageCandidates,   // generating and coarsely scoring the pupil candidates
+  kStageRefine,
+  kStageQueueWait,    // from a frame being captured until tracking starts on it, includes the USB transfer
+  kStageLatency,      // from a frame being captured until its result is out
+  kNumStages
+};
+
+#ifdef SMARTGAZE_INSTRUMENTATION
+
+#include <chrono>
+
+class StageTimer {
+  Stage stage;
+  int64_t start;
+public:
+  static int64_t now() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+  }
+  explicit StageTimer(Stage stage) : stage(stage), start(now()) {}
+  ~StageTimer();
+};
+
+#define INSTRUMENT_CONCAT2(a, b) a##b
+#define INSTRUMENT_CONCAT(a, b) INSTRUMENT_CONCAT2(a, b)
+#define INSTRUMENT_STAGE(stage) StageTimer INSTRUMENT_CONCAT(stageTimer, __LINE__)(stage)
+
+// Records a span that can't be a scope, like one starting on another thread. Times are StageTimer::now().
+void recordStageTime(Stage stage, int64_t start, int64_t end);
+
+// Prints the count and p50/p99/p99.9/max time of every stage recorded since the last report.
+void printStageReport(FILE *f);
+// Writes the most recent events of every thread as Chrome trace event JSON, for chrome://tracing.
+bool writeStageTrace(const char *path);
+
+#else
+
+#define INSTRUMENT_STAGE(stage) do {} while(0)
+inline void recordStageTime(Stage stage, int64_t start, int64_t end) {}
+inline void printStageReport(FILE *f) {}
+inline bool writeStageTrace(const char *path) { return false; }
+
+#endif
+
+#endif
@@ -2,132 +2,245 @@
 // Copyright (C) 2016  Tristan Hume
 // Released under GPLv2, see LICENSE file for full text
 
-#include <libuvc/libuvc.h>
 #include <opencv2/highgui/highgui.hpp>
 #include <opencv2/imgproc/imgproc.hpp>
 
+#include <poll.h>
 #include <stdio.h>
-#include <unistd.h>
+#include <string.h>
+#include <stdlib.h>
 #include <stdint.h>
+#include <inttypes.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <thread>
 
 #include "eyetracking.h"
+#include "frameAccounting.h"
+#include "frameSource.h"
+#include "frameQueue.h"
+#include "gazeServer.h"
+#include "instrument.h"
+#include "recording.h"
+#include "resultRing.h"
+
+static const int kDefaultQueueSize = 4;
+static const int kDefaultReportSeconds = 5;
+static const char *const kDefaultTracePath = "smartgaze_trace.json";
+static const int kPublishedResults = 256; // a few seconds of history for readers that poll slowly
+
+struct AppData {
+  TrackingData *tracking;
+  FrameRecorder *recorder;
+  FrameQueue *queue; // null when frames are tracked directly on the source thread
+  ResultPublisher *publisher; // null unless results are published to shared memory
+  GazeServer *server;         // null unless serving clients over sockets
+  FrameAccounting accounting;
+};
 
-static const int kCaptureWidth = 1536;
-static const int kCaptureHeight = 1024;
-static const int kCaptureFPS = 60;
-static const uint8_t kCurveData[8] = {250, 0, 240, 0, 250, 0, 240, 0};
-static const int kDefaultGain = 30;
-
-/* This callback function runs once per frame. Use it to perform any
- * quick processing you need, or have it put the frame into your application's
- * input queue. If this function takes too long, you'll start losing frames. */
-void cb(uvc_frame_t *frame, void *data) {
-  cv::Mat cvFrame(frame->height, frame->width, CV_16UC1, frame->data);
-  trackFrame((TrackingData*)(data), cvFrame);
+static void track(AppData *app, Frame &frame) {
+  cv::Mat cvFrame(frame.height, frame.width, CV_16UC1, frame.data);
+  int64_t startUs = monotonicUs();
+  TrackingResult result = trackFrame(app->tracking, cvFrame, frame.sequence, frame.timestampUs);
+  result.capturedUs = frame.capturedUs;
+  result.resultUs = monotonicUs();
+  app->accounting.frameTracked(frame, startUs, result.resultUs);
+  if(app->publisher) publishResult(app->publisher, result);
+  if(app->server) serveResult(app->server, result);
 }
 
-void setLights(uvc_device_handle_t *devh, int lights) {
-  uvc_set_ctrl(devh, 3, 3, (void*)(&lights), 2);
+/* Runs once per frame on the frame source's thread. If this takes too long
+ * the camera starts losing frames, so normally it only copies into the queue. */
+static void onFrame(Frame &frame, void *data) {
+  AppData *app = (AppData*)(data);
+  app->accounting.frameReceived(frame);
+  if(app->recorder) recordFrame(app->recorder, frame);
+  if(app->queue) {
+    app->queue->push(frame);
+  } else {
+    track(app, frame);
+  }
 }
 
-void setupParams(uvc_device_handle_t *devh) {
-  uvc_set_ctrl(devh, 3, 4, (void*)(kCurveData), 8);
+static void trackingThread(AppData *app) {
+  while(Frame *frame = app->queue->acquire()) {
+    track(app, *frame);
+    app->queue->release();
+  }
+}
+
+static void printQueueStats(FrameQueue *queue) {
+  FrameQueueStats s = queue->stats();
+  printf("frames enqueued: %" PRIu64 " processed: %" PRIu64 " dropped: %" PRIu64 "\n", s.enqueued, s.processed, s.dropped);
+}
+
+// Without any windows HighGUI can't deliver key presses, so headless runs read them from stdin.
+static int waitKeyHeadless(int delayMs) {
+  struct pollfd pfd;
+  pfd.fd = 0;
+  pfd.events = POLLIN;
+  if(poll(&pfd, 1, delayMs) <= 0) return -1;
+  char c;
+  if(read(0, &c, 1) != 1) return -1;
+  return c;
+}
+
+static void usage(const char *prog) {
+  fprintf(stderr, "usage: %s [--replay file [--fast]] [--record file] [--queue n] [--drop oldest|newest] [--headless] [--defect x,y]... [--full-glint-scan] [--inpaint] [--ransac-float] [--seed n] [--publish name] [--serve [port]] [--serve-unix path] [--report seconds] [--trace file]\n", prog);
+  fprintf(stderr, "  --replay file  track frames from a recording instead of the Eye Tribe\n");
+  fprintf(stderr, "  --fast         replay as fast as tracking allows instead of at the recorded rate\n");
+  fprintf(stderr, "  --record file  save every frame to a recording\n");
+  fprintf(stderr, "  --queue n      frames buffered between capture and tracking, 0 tracks on the capture thread\n");
+  fprintf(stderr, "  --drop policy  which frame to discard when tracking falls behind, default oldest\n");
+  fprintf(stderr, "  --headless     no debug windows or drawing, keys are read from stdin\n");
+  fprintf(stderr, "  --defect x,y   paste over a stuck sensor pixel, may be repeated\n");
+  fprintf(stderr, "  --full-glint-scan  search the whole frame for glints every frame instead of tracking them\n");
+  fprintf(stderr, "  --inpaint      remove glints with slower Navier-Stokes inpainting instead of the fast fill\n");
+  fprintf(stderr, "  --ransac-float score pupil ellipse hypotheses in single precision\n");
+  fprintf(stderr, "  --seed n       seed for the pupil ellipse RANSAC, runs with the same seed give the same fits\n");
+  fprintf(stderr, "  --publish name publish results to the shared memory ring name, like /smartgaze\n");
+  fprintf(stderr, "  --serve [port] serve the Eye Tribe JSON API on localhost, by default on port %d\n", kEyeTribePort);
+  fprintf(stderr, "  --serve-unix path  serve the Eye Tribe JSON API on a Unix socket\n");
+  fprintf(stderr, "  --report seconds  how often to print stage timing percentiles, 0 for never, default %d\n", kDefaultReportSeconds);
+  fprintf(stderr, "  --trace file   where the t key writes a Chrome trace of recent stages, default %s\n", kDefaultTracePath);
 }
 
 int main(int argc, char **argv) {
-  uvc_context_t *ctx;
-  uvc_device_t *dev;
-  uvc_device_handle_t *devh;
-  uvc_stream_ctrl_t ctrl;
-  uvc_error_t res;
-  /* Initialize a UVC service context. Libuvc will set up its own libusb
-   * context. Replace NULL with a libusb_context pointer to run libuvc
-   * from an existing libusb context. */
-  res = uvc_init(&ctx, NULL);
-  if (res < 0) {
-    uvc_perror(res, "uvc_init");
-    return res;
-  }
-  TrackingData *data = setupTracking();
-  puts("UVC initialized");
-  /* Locates the first attached UVC device, stores in dev */
-  res = uvc_find_device(
-      ctx, &dev,
-      10667, 251, NULL); /* filter devices: vendor_id, product_id, "serial_num" */
-  if (res < 0) {
-    uvc_perror(res, "uvc_find_device"); /* no devices found */
-  } else {
-    puts("Device found");
-    /* Try to open the device: requires exclusive access */
-    res = uvc_open(dev, &devh);
-    if (res < 0) {
-      uvc_perror(res, "uvc_open"); /* unable to open device */
+  const char *replayPath = nullptr;
+  const char *recordPath = nullptr;
+  const char *publishName = nullptr;
+  const char *tracePath = kDefaultTracePath;
+  int reportSeconds = kDefaultReportSeconds;
+  bool fast = false;
+  int queueSize = kDefaultQueueSize;
+  OverflowPolicy policy = kDropOldest;
+  TrackingOptions opts;
+  GazeServerOptions serverOpts;
+  for(int i = 1; i < argc; ++i) {
+    if(strcmp(argv[i], "--replay") == 0 && i+1 < argc) {
+      replayPath = argv[++i];
+    } else if(strcmp(argv[i], "--record") == 0 && i+1 < argc) {
+      recordPath = argv[++i];
+    } else if(strcmp(argv[i], "--fast") == 0) {
+      fast = true;
+    } else if(strcmp(argv[i], "--defect") == 0 && i+1 < argc) {
+      cv::Point p;
+      if(sscanf(argv[++i], "%d,%d", &p.x, &p.y) != 2) {
+        usage(argv[0]);
+        return 1;
+      }
+      opts.defectivePixels.push_back(p);
+    } else if(strcmp(argv[i], "--full-glint-scan") == 0) {
+      opts.temporalGlints = false;
+    } else if(strcmp(argv[i], "--inpaint") == 0) {
+      opts.inpaintGlints = true;
+    } else if(strcmp(argv[i], "--ransac-float") == 0) {
+      opts.ransacSinglePrecision = true;
+    } else if(strcmp(argv[i], "--seed") == 0 && i+1 < argc) {
+      opts.ransacSeed = strtoul(argv[++i], nullptr, 10);
+    } else if(strcmp(argv[i], "--publish") == 0 && i+1 < argc) {
+      publishName = argv[++i];
+    } else if(strcmp(argv[i], "--serve") == 0) {
+      serverOpts.tcpPort = kEyeTribePort;
+      if(i+1 < argc && argv[i+1][0] != '-') serverOpts.tcpPort = atoi(argv[++i]);
+    } else if(strcmp(argv[i], "--serve-unix") == 0 && i+1 < argc) {
+      serverOpts.unixPath = argv[++i];
+    } else if(strcmp(argv[i], "--report") == 0 && i+1 < argc) {
+      reportSeconds = atoi(argv[++i]);
+    } else if(strcmp(argv[i], "--trace") == 0 && i+1 < argc) {
+      tracePath = argv[++i];
+    } else if(strcmp(argv[i], "--headless") == 0) {
+      opts.debugView = false;
+    } else if(strcmp(argv[i], "--queue") == 0 && i+1 < argc) {
+      queueSize = atoi(argv[++i]);
+    } else if(strcmp(argv[i], "--drop") == 0 && i+1 < argc) {
+      ++i;
+      if(strcmp(argv[i], "oldest") == 0) {
+        policy = kDropOldest;
+      } else if(strcmp(argv[i], "newest") == 0) {
+        policy = kDropNewest;
+      } else {
+        usage(argv[0]);
+        return 1;
+      }
     } else {
-      puts("Device opened");
-      /* Print out a message containing all the information that libuvc
-       * knows about the device */
-      uvc_print_diag(devh, stderr);
-      /* Try to negotiate a YUYV stream profile */
-      res = uvc_get_stream_ctrl_format_size(
-          devh, &ctrl, /* result stored in ctrl */
-          UVC_FRAME_FORMAT_YUYV, /* YUV 422, aka YUV 4:2:2. try _COMPRESSED */
-          kCaptureWidth, kCaptureHeight, kCaptureFPS /* width, height, fps */
-      );
-      /* Print out the result */
-      uvc_print_stream_ctrl(&ctrl, stderr);
-      if (res < 0) {
-        uvc_perror(res, "get_mode"); /* device doesn't provide a matching stream */
+      usage(argv[0]);
+      return 1;
+    }
+  }
+
+  FrameSource *source = replayPath ? createReplaySource(replayPath, !fast) : createUVCSource();
+  if(source == nullptr) return 1;
+
+  AppData app;
+  app.tracking = setupTracking(opts);
+  app.recorder = nullptr;
+  if(recordPath) {
+    app.recorder = createRecorder(recordPath, kCaptureWidth, kCaptureHeight);
+    if(app.recorder == nullptr) return 1;
+  }
+  app.publisher = nullptr;
+  if(publishName) {
+    app.publisher = createResultPublisher(publishName, kPublishedResults);
+    if(app.publisher == nullptr) return 1;
+  }
+  app.server = nullptr;
+  if(serverOpts.tcpPort || serverOpts.unixPath) {
+    app.server = createGazeServer(serverOpts);
+    if(app.server == nullptr) return 1;
+  }
+
+  // fast replay measures throughput, so it must wait for tracking rather than drop frames
+  app.queue = nullptr;
+  std::thread tracker;
+  if(queueSize > 0 && !(replayPath && fast)) {
+    app.queue = new FrameQueue(queueSize, kCaptureWidth, kCaptureHeight, policy);
+    tracker = std::thread(trackingThread, &app);
+  }
+
+  if(source->start(onFrame, (void*)(&app))) {
+    auto lastReport = std::chrono::steady_clock::now();
+    while(!source->finished()) {
+      int key;
+      if(opts.debugView) {
+        showTrackingDebug(app.tracking);
+        key = cv::waitKey(10);
       } else {
-        setLights(devh, 0b1111);
-        uvc_set_gain(devh, kDefaultGain);
-        setupParams(devh);
-        /* Start the video stream. The library will call user function cb:
-         *   cb(frame, (void*) 0)
-         */
-        res = uvc_start_streaming(devh, &ctrl, cb, (void*)(data), 0);
-        if (res < 0) {
-          uvc_perror(res, "start_streaming"); /* unable to start stream */
-        } else {
-          puts("Streaming...");
-          // uvc_set_ae_mode(devh, 1); /* e.g., turn on auto exposure */
-          while(true) {
-            int key = cv::waitKey(10);
-            if((char)key == 'q') {
-              break;
-            } else if((char)key == 'o') {
-              setLights(devh, 0);
-            } else if((char)key == 'p') {
-              setupParams(devh);
-            } else if((char)key == 'g') {
-              uvc_set_gain(devh, 0);
-            } else if((char)key == 'G') {
-              uvc_set_gain(devh, 51);
-            } else if((char)key == 'e') {
-              uint32_t exposure;
-              uvc_get_exposure_abs(devh, &exposure, UVC_GET_CUR);
-              printf("Exposure: %i\n", exposure);
-            } else if((char)key == 'E') {
-              uvc_set_exposure_abs(devh, 160);
-            }
-            // usleep(10000);
-          }
-          setLights(devh, 0);
-          sleep(1);
-          /* End the stream. Blocks until last callback is serviced */
-          uvc_stop_streaming(devh);
-          puts("Done streaming.");
-        }
+        key = waitKeyHeadless(10);
+      }
+      if((char)key == 'q') {
+        break;
+      } else if((char)key == 's') {
+        printFrameAccounting(stdout, app.accounting.stats());
+        if(app.queue) printQueueStats(app.queue);
+      } else if((char)key == 't' && writeStageTrace(tracePath)) {
+        printf("wrote trace to %s\n", tracePath);
       }
-      /* Release our handle on the device */
-      uvc_close(devh);
-      puts("Device closed");
+      // reported from here rather than the tracking thread so printing never delays a frame
+      auto now = std::chrono::steady_clock::now();
+      if(reportSeconds > 0 && now - lastReport >= std::chrono::seconds(reportSeconds)) {
+        printFrameAccounting(stdout, app.accounting.stats());
+        printStageReport(stdout);
+        lastReport = now;
+      }
+      source->handleKey((char)key);
     }
-    /* Release the device descriptor */
-    uvc_unref_device(dev);
+    source->stop();
+  }
+  delete source;
+
+  if(app.queue) {
+    app.queue->close();
+    tracker.join();
+    printQueueStats(app.queue);
+    delete app.queue;
   }
-  /* Close the UVC context. This closes and cleans up any existing device handles,
-   * and it closes the libusb context if one was not provided. */
-  uvc_exit(ctx);
-  puts("UVC exited");
+  printFrameAccounting(stdout, app.accounting.stats());
+  deleteTracking(app.tracking);
+
+  if(app.recorder) closeRecorder(app.recorder);
+  if(app.publisher) deleteResultPublisher(app.publisher);
+  if(app.server) deleteGazeServer(app.server);
   return 0;
 }
@@ -0,0 +1,213 @@
+// The SmartGaze Eye Tracker
+// Copyright (C) 2016  Tristan Hume
+// Released under GPLv2, see LICENSE file for full text
+
+#include "rayCast.h"
+
+#include <assert.h>
+#include <cmath>
+
+using namespace cv;
+
+static const int kFixedShift = 16;
+static const double kFixedOne = 1 << kFixedShift;
+static const double kTwoPi = 6.283185307179586;
+// resolution of the arctangent table over slopes [0,1]
+static const int kAtanSteps = 1024;
+
+namespace {
+struct DirectionTable {
+  int32_t x[RayCaster::kRayAngles];
+  int32_t y[RayCaster::kRayAngles];
+  // atan(i/kAtanSteps) as a direction index, covers the first octant
+  uint16_t atan[kAtanSteps+1];
+  DirectionTable() {
+    for(int i = 0; i < RayCaster::kRayAngles; ++i) {
+      double angle = i*(kTwoPi/RayCaster::kRayAngles);
+      x[i] = (int32_t)std::lround(std::cos(angle)*kFixedOne);
+      y[i] = (int32_t)std::lround(std::sin(angle)*kFixedOne);
+    }
+    for(int i = 0; i <= kAtanSteps; ++i)
+      atan[i] = (uint16_t)std::lround(std::atan((double)i/kAtanSteps)*(RayCaster::kRayAngles/kTwoPi));
+  }
+};
+}
+
+// built on first use, function statics are initialized thread safely
+static const DirectionTable &directions() {
+  static const DirectionTable table;
+  return table;
+}
+
+void EdgePoints::clear() {
+  pos.clear();
+  diff.clear();
+  angle.clear();
+  radius.clear();
+  seed.clear();
+  seeds.clear();
+}
+
+int EdgePoints::addSeed(Point2f p) {
+  seeds.push_back(p);
+  return seeds.size()-1;
+}
+
+void EdgePoints::push(Point2f p, int d, int a, float r, int s) {
+  pos.push_back(p);
+  diff.push_back(d);
+  angle.push_back(a);
+  radius.push_back(r);
+  seed.push_back(s);
+}
+
+template<typename T>
+static void selectInPlace(std::vector<T> &v, const std::vector<int> &keep) {
+  // keep is arbitrary so gather through a copy rather than compacting in place
+  std::vector<T> kept;
+  kept.reserve(keep.size());
+  for(int i : keep) kept.push_back(v[i]);
+  v.swap(kept);
+}
+
+void EdgePoints::select(const std::vector<int> &keep) {
+  selectInPlace(pos, keep);
+  selectInPlace(diff, keep);
+  selectInPlace(angle, keep);
+  selectInPlace(radius, keep);
+  selectInPlace(seed, keep);
+}
+
+int RayCaster::angleIndex(double angle) {
+  return (int)std::lround(angle*(kRayAngles/kTwoPi)) & (kRayAngles-1);
+}
+
+double RayCaster::indexAngle(int index) {
+  return index*(kTwoPi/kRayAngles);
+}
+
+int RayCaster::angleIndexOf(float dx, float dy) {
+  const DirectionTable &table = directions();
+  float ax = std::abs(dx), ay = std::abs(dy);
+  if(ax == 0 && ay == 0) return 0;
+  // fold into the first octant, look up and unfold
+  int a;
+  if(ax >= ay) {
+    a = table.atan[(int)(ay/ax*kAtanSteps + 0.5f)];
+  } else {
+    a = kRayAngles/4 - table.atan[(int)(ax/ay*kAtanSteps + 0.5f)];
+  }
+  if(dx < 0) a = kRayAngles/2 - a;
+  if(dy < 0) a = kRayAngles - a;
+  return a & (kRayAngles-1);
+}
+
+void RayCaster::setImage(const Mat &m, const Mat &validMask) {
+  assert(m.type() == CV_8UC1 && validMask.type() == CV_8UC1 && m.size() == validMask.size());
+  image = m.data;
+  imageStep = m.step;
+  valid = validMask.data;
+  validStep = validMask.step;
+  cols = m.cols;
+  rows = m.rows;
+}
+
+// Steps along every ray of the sweep, calling onStep(ray, angle index, rise, midpoint, radius) for each step
+// that rises by more than minRise with the mask set halfway along it. onStep returns true to stop following that ray.
+// Rays are walked one at a time: most end within a few steps, and stepping four per SSE2 lane, even
+// refilling lanes as rays end, was ~1.7x slower than this loop since every load is still a lane at a time.
+template<typename F>
+void RayCaster::walkRays(Point2f seed, int dis, double angleStep, double angleNormal, double angleSpread, int minRise, F &&onStep) {
+  const DirectionTable &table = directions();
+  const int32_t maxX = cols << kFixedShift, maxY = rows << kFixedShift;
+  const int32_t startX = (int32_t)std::lround(seed.x*kFixedOne), startY = (int32_t)std::lround(seed.y*kFixedOne);
+
+  // angles are still walked in doubles so the rays are the same ones the trig based version cast,
+  // only rounded to the nearest table direction
+  int ray = 0;
+  for(double angle = angleNormal-angleSpread/2+0.0001; angle < angleNormal+angleSpread/2; angle += angleStep, ++ray) {
+    int index = angleIndex(angle);
+    int32_t stepX = table.x[index]*dis, stepY = table.y[index]*dis;
+    int32_t halfX = stepX/2, halfY = stepY/2;
+    int32_t px = startX + stepX, py = startY + stepY;
+    if(px < 0 || px >= maxX || py < 0 || py >= maxY) continue;
+
+    int pixel1 = image[(py >> kFixedShift)*imageStep + (px >> kFixedShift)];
+    // midpoint of the step from p to p+step, in steps from the seed
+    float steps = 1.5f;
+    while(true) {
+      px += stepX;
+      py += stepY;
+      if(px < 0 || px >= maxX || py < 0 || py >= maxY) break;
+      int pixel2 = image[(py >> kFixedShift)*imageStep + (px >> kFixedShift)];
+      int rise = pixel2 - pixel1;
+      if(rise > minRise) {
+        int32_t mx = px - halfX, my = py - halfY;
+        if(valid[(my >> kFixedShift)*validStep + (mx >> kFixedShift)] &&
+           onStep(ray, index, rise, Point2f(mx*(float)(1.0/kFixedOne), my*(float)(1.0/kFixedOne)), steps*dis))
+          break;
+      }
+      pixel1 = pixel2;
+      steps += 1;
+    }
+  }
+}
+
+void RayCaster::cast(EdgePoints &edges, int seed, int dis, double angleStep, double angleNormal, double angleSpread, int edgeThresh) {
+  walkRays(edges.seeds[seed], dis, angleStep, angleNormal, angleSpread, edgeThresh,
+           [&](int, int index, int rise, Point2f p, float radius) {
+    edges.push(p, rise, index, radius, seed);
+    return true;
+  });
+}
+
+void RayCaster::castProfiles(Point2f seed, int dis, double angleStep, double angleNormal, double angleSpread) {
+  rayStart.clear();
+  rayAngle.clear();
+  recordRise.clear();
+  recordPos.clear();
+  recordRadius.clear();
+  int lastRay = -1, best = 0;
+  walkRays(seed, dis, angleStep, angleNormal, angleSpread, 0, [&](int ray, int index, int rise, Point2f p, float radius) {
+    if(ray != lastRay) {
+      rayStart.push_back(recordRise.size());
+      rayAngle.push_back(index);
+      lastRay = ray;
+      best = 0;
+    }
+    if(rise > best) {
+      best = rise;
+      recordRise.push_back(rise);
+      recordPos.push_back(p);
+      recordRadius.push_back(radius);
+    }
+    return false;
+  });
+  rayStart.push_back(recordRise.size());
+
+  // histogram of each ray's largest rise, summed from the top so raysOver[t] counts the rises above t
+  int histogram[257] = {0};
+  for(unsigned i = 0; i+1 < rayStart.size(); ++i)
+    histogram[recordRise[rayStart[i+1]-1]]++;
+  int above = 0;
+  for(int t = 255; t >= 0; --t) {
+    above += histogram[t+1];
+    raysOver[t] = above;
+  }
+}
+
+int RayCaster::raysAbove(int edgeThresh) const {
+  if(edgeThresh < 0) edgeThresh = 0;
+  return edgeThresh > 255 ? 0 : raysOver[edgeThresh];
+}
+
+void RayCaster::edgesAbove(EdgePoints &edges, int seed, int edgeThresh) const {
+  for(unsigned i = 0; i+1 < rayStart.size(); ++i) {
+    for(int r = rayStart[i]; r < rayStart[i+1]; ++r) {
+      if(recordRise[r] > edgeThresh) {
+        edges.push(recordPos[r], recordRise[r], rayAngle[i], recordRadius[r], seed);
+        break;
+      }
+    }
+  }
+}
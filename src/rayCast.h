@@ -0,0 +1,77 @@
+// The SmartGaze Eye Tracker
+// Copyright (C) 2016  Tristan Hume
+// Released under GPLv2, see LICENSE file for full text
+#ifndef RAYCAST_H__
+#define RAYCAST_H__
+
+#include <opencv2/imgproc/imgproc.hpp>
+#include <stdint.h>
+#include <vector>
+
+// Edge points found along starburst rays, one array per field. Along with its position each point
+// keeps what the caster already knew about it, so later stages don't have to recover it with trig.
+struct EdgePoints {
+  std::vector<cv::Point2f> pos;
+  std::vector<int> diff;        // intensity rise across the edge
+  std::vector<uint16_t> angle;  // direction table index of the ray it was found on
+  std::vector<float> radius;    // distance along the ray from its seed
+  std::vector<uint16_t> seed;   // index into seeds of where the ray started
+  std::vector<cv::Point2f> seeds;
+
+  size_t size() const { return pos.size(); }
+  void clear();
+  int addSeed(cv::Point2f p);
+  void push(cv::Point2f p, int d, int a, float r, int s);
+  // keeps only the points listed in keep, in that order
+  void select(const std::vector<int> &keep);
+};
+
+// Casts the starburst rays through an 8 bit eye image. Directions come from a table of
+// kRayAngles evenly spaced angles and rays are stepped in 16.16 fixed point, so casting
+// does no trig and no floating point per step. Keep one per eye so its buffers are reused.
+class RayCaster {
+public:
+  static const int kRayAngles = 4096; // a power of two so angle indices wrap with a mask
+
+  // the image and the mask of where edges may be, both 8 bit and the same size, must outlive the casts
+  void setImage(const cv::Mat &m, const cv::Mat &validMask);
+
+  // Casts a ray every angleStep radians across angleSpread centred on angleNormal from the seed
+  // edges.seeds[seed], stepping dis pixels at a time. Appends the first step on each ray where the
+  // intensity rises by more than edgeThresh with the mask set halfway along it, at the step's midpoint.
+  void cast(EdgePoints &edges, int seed, int dis, double angleStep, double angleNormal, double angleSpread, int edgeThresh);
+
+  // Casts the same rays as cast() but without a threshold, following each one to the image border and
+  // keeping the steps whose rise beats every earlier valid step on the ray. The first step above any
+  // threshold is always one of these, so one sweep answers raysAbove and edgesAbove for every threshold.
+  void castProfiles(cv::Point2f seed, int dis, double angleStep, double angleNormal, double angleSpread);
+  // number of rays in the last profiled sweep that have an edge above edgeThresh
+  int raysAbove(int edgeThresh) const;
+  // appends what cast() would have found with edgeThresh on the rays of the last profiled sweep
+  void edgesAbove(EdgePoints &edges, int seed, int edgeThresh) const;
+
+  // table index of the direction closest to angle
+  static int angleIndex(double angle);
+  // table index of the direction of (dx,dy), looked up from a table rather than with atan2
+  static int angleIndexOf(float dx, float dy);
+  static double indexAngle(int index);
+
+private:
+  const uint8_t *image;
+  const uint8_t *valid;
+  size_t imageStep, validStep;
+  int cols, rows;
+
+  // the last profiled sweep, the record steps of ray i are [rayStart[i], rayStart[i+1])
+  std::vector<int> rayStart;
+  std::vector<uint16_t> rayAngle;
+  std::vector<int> recordRise;
+  std::vector<cv::Point2f> recordPos;
+  std::vector<float> recordRadius;
+  // raysOver[t] is how many rays have a record rise above t
+  int raysOver[256];
+
+  template<typename F> void walkRays(cv::Point2f seed, int dis, double angleStep, double angleNormal, double angleSpread, int minRise, F &&onStep);
+};
+
+#endif
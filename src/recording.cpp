@@ -0,0 +1,207 @@
+// The SmartGaze Eye Tracker
+// Copyright (C) 2016  Tristan Hume
+// Released under GPLv2, see LICENSE file for full text
+
+#include "recording.h"
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+static const int64_t kDefaultFrameIntervalUs = 1000000 / kCaptureFPS;
+
+static size_t frameStride(int width, int height) {
+  return sizeof(RecordedFrameHeader) + sizeof(uint16_t)*width*height;
+}
+
+struct FrameRecorder {
+  FILE *file;
+  int width;
+  int height;
+};
+
+FrameRecorder *createRecorder(const char *path, int width, int height) {
+  FILE *file = fopen(path, "wb");
+  if(file == nullptr) {
+    perror("createRecorder");
+    return nullptr;
+  }
+  RecordingHeader header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, kRecordingMagic, sizeof(header.magic));
+  header.version = kRecordingVersion;
+  header.width = width;
+  header.height = height;
+  fwrite(&header, sizeof(header), 1, file);
+
+  FrameRecorder *rec = new FrameRecorder();
+  rec->file = file;
+  rec->width = width;
+  rec->height = height;
+  return rec;
+}
+
+void recordFrame(FrameRecorder *rec, const Frame &frame) {
+  if(frame.width != rec->width || frame.height != rec->height) return;
+  RecordedFrameHeader header;
+  header.timestampUs = frame.timestampUs;
+  header.sequence = frame.sequence; // kept so replays show the same gaps
+  header.reserved = 0;
+  fwrite(&header, sizeof(header), 1, rec->file);
+  fwrite(frame.data, sizeof(uint16_t), frame.width*frame.height, rec->file);
+}
+
+void closeRecorder(FrameRecorder *rec) {
+  fclose(rec->file);
+  delete rec;
+}
+
+struct RecordingReader {
+  uint8_t *map;
+  size_t mapSize;
+  int width;
+  int height;
+  size_t numFrames;
+};
+
+static RecordedFrameHeader *frameHeader(RecordingReader *reader, size_t i) {
+  return (RecordedFrameHeader*)(reader->map + sizeof(RecordingHeader) + i*frameStride(reader->width, reader->height));
+}
+
+RecordingReader *openRecording(const char *path) {
+  int fd = ::open(path, O_RDONLY);
+  if(fd < 0) {
+    perror("openRecording");
+    return nullptr;
+  }
+  struct stat st;
+  if(fstat(fd, &st) != 0 || (size_t)(st.st_size) < sizeof(RecordingHeader)) {
+    fprintf(stderr, "Error! %s is not a recording\n", path);
+    close(fd);
+    return nullptr;
+  }
+  size_t mapSize = st.st_size;
+  // Private writable mapping, tracking patches defective pixels in place and
+  // those writes must never reach the file.
+  void *m = mmap(nullptr, mapSize, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if(m == MAP_FAILED) {
+    perror("mmap");
+    return nullptr;
+  }
+  uint8_t *map = (uint8_t*)(m);
+  madvise(map, mapSize, MADV_SEQUENTIAL);
+  madvise(map, mapSize, MADV_WILLNEED);
+
+  RecordingHeader *header = (RecordingHeader*)(map);
+  if(memcmp(header->magic, kRecordingMagic, sizeof(header->magic)) != 0 || header->version != kRecordingVersion) {
+    fprintf(stderr, "Error! %s is not a version %u recording\n", path, kRecordingVersion);
+    munmap(map, mapSize);
+    return nullptr;
+  }
+  RecordingReader *reader = new RecordingReader();
+  reader->map = map;
+  reader->mapSize = mapSize;
+  reader->width = header->width;
+  reader->height = header->height;
+  reader->numFrames = (mapSize - sizeof(RecordingHeader)) / frameStride(reader->width, reader->height);
+  if(reader->numFrames == 0) {
+    fprintf(stderr, "Error! %s contains no frames\n", path);
+    closeRecording(reader);
+    return nullptr;
+  }
+  return reader;
+}
+
+size_t recordingFrameCount(RecordingReader *reader) {
+  return reader->numFrames;
+}
+
+Frame recordedFrame(RecordingReader *reader, size_t i) {
+  RecordedFrameHeader *header = frameHeader(reader, i);
+  Frame f;
+  f.data = (uint16_t*)(header+1);
+  f.width = reader->width;
+  f.height = reader->height;
+  f.timestampUs = header->timestampUs;
+  f.sequence = header->sequence;
+  f.capturedUs = 0;
+  return f;
+}
+
+void closeRecording(RecordingReader *reader) {
+  munmap(reader->map, reader->mapSize);
+  delete reader;
+}
+
+class ReplaySource : public FrameSource {
+  RecordingReader *reader;
+  bool realtime;
+
+  std::thread thread;
+  std::atomic<bool> stopping{false};
+  std::atomic<bool> done{false};
+
+  void run(FrameCallback cb, void *userData) {
+    typedef std::chrono::steady_clock Clock;
+    Clock::time_point start = Clock::now();
+    size_t numFrames = recordingFrameCount(reader);
+    int64_t lastTimestamp = 0;
+    int64_t offsetUs = 0;
+    size_t i;
+    for(i = 0; i < numFrames && !stopping; ++i) {
+      Frame f = recordedFrame(reader, i);
+      if(realtime) {
+        // recordings made without timestamps still play at the capture rate
+        int64_t delta = f.timestampUs - lastTimestamp;
+        offsetUs += (i == 0) ? 0 : ((delta > 0) ? delta : kDefaultFrameIntervalUs);
+        lastTimestamp = f.timestampUs;
+        std::this_thread::sleep_until(start + std::chrono::microseconds(offsetUs));
+      }
+      // a replayed frame is captured when it is delivered, there is no transfer to account for
+      f.capturedUs = monotonicUs();
+      cb(f, userData);
+    }
+    double elapsed = std::chrono::duration<double>(Clock::now()-start).count();
+    printf("Replayed %zu frames in %.3fs (%.1f fps)\n", i, elapsed, i/elapsed);
+    done = true;
+  }
+
+public:
+  ReplaySource(RecordingReader *reader, bool realtime) : reader(reader), realtime(realtime) {}
+
+  bool start(FrameCallback cb, void *userData) override {
+    stopping = false;
+    done = false;
+    thread = std::thread(&ReplaySource::run, this, cb, userData);
+    return true;
+  }
+
+  void stop() override {
+    stopping = true;
+    if(thread.joinable()) thread.join();
+  }
+
+  bool finished() override {
+    return done;
+  }
+
+  ~ReplaySource() {
+    stop();
+    closeRecording(reader);
+  }
+};
+
+FrameSource *createReplaySource(const char *path, bool realtime) {
+  RecordingReader *reader = openRecording(path);
+  if(reader == nullptr) return nullptr;
+  Frame first = recordedFrame(reader, 0);
+  printf("Replaying %zu frames of %ix%i from %s\n", recordingFrameCount(reader), first.width, first.height, path);
+  return new ReplaySource(reader, realtime);
+}
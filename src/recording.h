@@ -0,0 +1,55 @@
+// The SmartGaze Eye Tracker
+// Copyright (C) 2016  Tristan Hume
+// Released under GPLv2, see LICENSE file for full text
+#ifndef RECORDING_H__
+#define RECORDING_H__
+
+#include "frameSource.h"
+
+#include <stdint.h>
+#include <stdio.h>
+
+// Recordings are a 32 byte RecordingHeader followed by frames which are each
+// a RecordedFrameHeader followed by width*height little endian uint16 pixels.
+// The sizes keep every frame's pixel data 16 byte aligned in the file.
+static const char kRecordingMagic[4] = {'S','G','R','F'};
+static const uint32_t kRecordingVersion = 1;
+
+struct RecordingHeader {
+  char magic[4];
+  uint32_t version;
+  uint32_t width;
+  uint32_t height;
+  uint32_t reserved[4];
+};
+
+struct RecordedFrameHeader {
+  int64_t timestampUs;
+  uint32_t sequence;
+  uint32_t reserved;
+};
+
+// Appends frames to a recording file, returns nullptr if the file can't be created.
+struct FrameRecorder;
+FrameRecorder *createRecorder(const char *path, int width, int height);
+void recordFrame(FrameRecorder *rec, const Frame &frame);
+void closeRecorder(FrameRecorder *rec);
+
+// Random access to the frames of a recording through a private memory mapping.
+// Returns nullptr if the file can't be mapped, isn't a valid recording or has no frames,
+// so an open reader always has frame 0.
+struct RecordingReader;
+RecordingReader *openRecording(const char *path);
+size_t recordingFrameCount(RecordingReader *reader);
+// Frame i, its data points into the mapping and stays valid until the reader is closed.
+// Writes to it are private to this process and never reach the file.
+Frame recordedFrame(RecordingReader *reader, size_t i);
+void closeRecording(RecordingReader *reader);
+
+// Replays a recording by memory mapping it. In realtime mode frames are delivered
+// with the spacing of their recorded timestamps, otherwise each frame is delivered
+// as soon as the callback for the previous one returns.
+// Returns nullptr if the file can't be mapped or isn't a valid recording.
+FrameSource *createReplaySource(const char *path, bool realtime);
+
+#endif
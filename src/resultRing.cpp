@@ -0,0 +1,178 @@
+// The SmartGaze Eye Tracker
+// Copyright (C) 2016  Tristan Hume
+// Released under GPLv2, see LICENSE file for full text
+
+#include "resultRing.h"
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <atomic>
+#include <string>
+
+static const char kRingMagic[4] = {'S','G','R','R'};
+static const uint32_t kRingVersion = 2;
+
+// the atomics live in memory shared between processes, which only works if they need no lock
+static_assert(ATOMIC_LLONG_LOCK_FREE == 2, "64 bit atomics must be lock free");
+
+struct RingSlot {
+  // even when the slot is stable, odd while it is being written; bumped by 2 per write
+  std::atomic<uint64_t> seq;
+  TrackingResult result;
+};
+
+struct RingHeader {
+  char magic[4];
+  uint32_t version;
+  uint32_t capacity;
+  uint32_t slotSize;
+  // number of results published, result n is in slot n & (capacity-1)
+  std::atomic<uint64_t> published;
+  char pad[64-24]; // keep the writer's counter off the first slot's cache line
+};
+
+static size_t ringSize(uint32_t capacity) {
+  return sizeof(RingHeader) + capacity*sizeof(RingSlot);
+}
+
+static RingSlot *ringSlots(RingHeader *header) {
+  return (RingSlot*)(header+1);
+}
+
+struct ResultPublisher {
+  std::string name;
+  RingHeader *header;
+  size_t size;
+};
+
+ResultPublisher *createResultPublisher(const char *name, int capacity) {
+  uint32_t cap = 1;
+  while(cap < (uint32_t)capacity) cap <<= 1;
+  size_t size = ringSize(cap);
+
+  // always start from a fresh object, readers still mapping a previous run's ring keep that one intact
+  shm_unlink(name);
+  int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0644);
+  if(fd < 0) {
+    perror("createResultPublisher shm_open");
+    return nullptr;
+  }
+  if(ftruncate(fd, size) != 0) {
+    perror("createResultPublisher ftruncate");
+    close(fd);
+    return nullptr;
+  }
+  void *map = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if(map == MAP_FAILED) {
+    perror("createResultPublisher mmap");
+    return nullptr;
+  }
+
+  // the object was just zero filled, which is a valid state for every atomic in it
+  RingHeader *header = (RingHeader*)map;
+  header->version = kRingVersion;
+  header->capacity = cap;
+  header->slotSize = sizeof(RingSlot);
+  header->published.store(0, std::memory_order_relaxed);
+  // readers check the magic last, so it is written once everything else is in place
+  std::atomic_thread_fence(std::memory_order_release);
+  memcpy(header->magic, kRingMagic, sizeof(kRingMagic));
+
+  ResultPublisher *pub = new ResultPublisher();
+  pub->name = name;
+  pub->header = header;
+  pub->size = size;
+  return pub;
+}
+
+void publishResult(ResultPublisher *pub, const TrackingResult &result) {
+  RingHeader *header = pub->header;
+  uint64_t n = header->published.load(std::memory_order_relaxed);
+  RingSlot &slot = ringSlots(header)[n & (header->capacity-1)];
+  uint64_t seq = slot.seq.load(std::memory_order_relaxed);
+  slot.seq.store(seq+1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  memcpy(&slot.result, &result, sizeof(result));
+  slot.seq.store(seq+2, std::memory_order_release);
+  header->published.store(n+1, std::memory_order_release);
+}
+
+void deleteResultPublisher(ResultPublisher *pub) {
+  munmap(pub->header, pub->size);
+  shm_unlink(pub->name.c_str());
+  delete pub;
+}
+
+struct ResultReader {
+  RingHeader *header;
+  size_t size;
+};
+
+ResultReader *openResultReader(const char *name) {
+  int fd = shm_open(name, O_RDONLY, 0);
+  if(fd < 0) return nullptr;
+  struct stat st;
+  if(fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(RingHeader)) {
+    close(fd);
+    return nullptr;
+  }
+  void *map = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if(map == MAP_FAILED) return nullptr;
+
+  RingHeader *header = (RingHeader*)map;
+  bool valid = memcmp(header->magic, kRingMagic, sizeof(kRingMagic)) == 0;
+  std::atomic_thread_fence(std::memory_order_acquire);
+  valid = valid && header->version == kRingVersion && header->slotSize == sizeof(RingSlot) &&
+          header->capacity > 0 && (size_t)st.st_size >= ringSize(header->capacity);
+  if(!valid) {
+    fprintf(stderr, "openResultReader: %s is not a compatible result ring\n", name);
+    munmap(map, st.st_size);
+    return nullptr;
+  }
+  ResultReader *reader = new ResultReader();
+  reader->header = header;
+  reader->size = st.st_size;
+  return reader;
+}
+
+void closeResultReader(ResultReader *reader) {
+  munmap(reader->header, reader->size);
+  delete reader;
+}
+
+uint64_t publishedResults(ResultReader *reader) {
+  return reader->header->published.load(std::memory_order_acquire);
+}
+
+bool readResult(ResultReader *reader, uint64_t n, TrackingResult &result) {
+  RingHeader *header = reader->header;
+  RingSlot &slot = ringSlots(header)[n & (header->capacity-1)];
+  // the slot holds result n once its sequence has been bumped n/capacity+1 times
+  uint64_t expected = 2*(n/header->capacity + 1);
+  while(true) {
+    uint64_t before = slot.seq.load(std::memory_order_acquire);
+    if(before < expected) return false; // not written yet
+    if(before > expected) return false; // overwritten by a later result
+    memcpy(&result, &slot.result, sizeof(result));
+    std::atomic_thread_fence(std::memory_order_acquire);
+    uint64_t after = slot.seq.load(std::memory_order_relaxed);
+    if(after == before) return true;
+    // the writer lapped us mid copy, it is a later result now
+  }
+}
+
+bool readLatestResult(ResultReader *reader, TrackingResult &result) {
+  while(true) {
+    uint64_t published = publishedResults(reader);
+    if(published == 0) return false;
+    if(readResult(reader, published-1, result)) return true;
+    // overwritten while reading, only possible if the writer went all the way round the ring
+  }
+}
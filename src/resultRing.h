@@ -0,0 +1,35 @@
+// The SmartGaze Eye Tracker
+// Copyright (C) 2016  Tristan Hume
+// Released under GPLv2, see LICENSE file for full text
+#ifndef RESULTRING_H__
+#define RESULTRING_H__
+
+#include "trackingResult.h"
+
+// Publishes tracking results to other local processes through a ring of slots in POSIX shared
+// memory. Each slot is a seqlock: the writer never waits for readers, and readers only touch
+// memory, so reading the latest result costs a couple of cache misses and no system calls.
+
+// Creates the shared memory object name, which should look like "/smartgaze", replacing any left
+// over from an earlier run. Readers have to reopen to follow a new publisher.
+// capacity is the number of results kept, rounded up to a power of two. Returns nullptr on failure.
+struct ResultPublisher;
+ResultPublisher *createResultPublisher(const char *name, int capacity);
+// never blocks, call from one thread only
+void publishResult(ResultPublisher *pub, const TrackingResult &result);
+// unlinks the shared memory object
+void deleteResultPublisher(ResultPublisher *pub);
+
+// Maps an existing ring read only. Returns nullptr if there is no ring called name.
+struct ResultReader;
+ResultReader *openResultReader(const char *name);
+void closeResultReader(ResultReader *reader);
+// Copies the newest result, false if nothing has been published yet.
+bool readLatestResult(ResultReader *reader, TrackingResult &result);
+// Copies the result published with index n (the nth publish since the ring was created, from 0).
+// False if it hasn't been published yet or has already been overwritten.
+bool readResult(ResultReader *reader, uint64_t n, TrackingResult &result);
+// index the next result will be published with
+uint64_t publishedResults(ResultReader *reader);
+
+#endif
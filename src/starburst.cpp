@@ -3,27 +3,116 @@
 // Released under GPLv2, see LICENSE file for full text
 
 #include "starburst.h"
-#include "ellipse.h"
+#include "debugView.h"
+#include "instrument.h"
+#include "threadPool.h"
 
-#include <opencv2/highgui/highgui.hpp>
+#include <algorithm>
 #include <cmath>
 
 static const int kNumFilterSegments = 30;
+// every candidate is first scored on a sparse contour, only those still in the running get the full one
+static const int kCoarseScoreDelta = 12;
+// a candidate whose coarse score is below this fraction of the best one can't win
+static const float kDominanceRatio = 0.6f;
+// contour gradient in levels per pixel at which a pupil fit counts as fully confident
+static const float kConfidentGradient = 10.0f;
 
 using namespace cv;
 using namespace std;
 
-extern vector <Point2f> edge_point;
-extern double pupil_param[5];
-void starburst_pupil_contour_detection(Mat &m, Mat &validMask, Point2f start_point, int edge_thresh, int N, int minimum_candidate_features);
-int* pupil_fitting_inliers(int width, int height, int &return_max_inliers);
 #ifndef PI
 #define PI 3.141592653589
 #endif
 
 int starThresh = 16;
 int starRays = 45;
-RotatedRect findEllipseStarburst(Mat &m, const std::string &debugName) {
+
+// keeps the lowest 3/5 of the edge points, the upper ones tend to be on the eyelid
+static void keepLowestEdges(StarburstContext &ctx) {
+  const vector<Point2f> &pos = ctx.edges.pos;
+  vector<int> &order = ctx.edge_order;
+  order.resize(pos.size());
+  for(unsigned i = 0; i < order.size(); i++) order[i] = i;
+  size_t kept = (size_t)(pos.size()*(3.0/5.0));
+  std::nth_element(order.begin(), order.begin()+kept, order.end(), [&pos](int a, int b) {
+      return pos[b].y < pos[a].y;
+  });
+  order.resize(kept);
+  ctx.edges.select(order);
+}
+
+// Splits the edge points into kNumFilterSegments equal angle segments around the starburst center
+// and keeps the point of median radius from each. Points found from the center already know their
+// ray's angle and radius, the rest get them from the direction table and a squared distance.
+static void filterEdgeSegments(StarburstContext &ctx, vector<Point2f> &goodPoints, DebugEyeView *debug) {
+  const EdgePoints &edges = ctx.edges;
+  if(edges.size() == 0) return;
+  Point2f center = edges.seeds[0];
+  int n = edges.size();
+
+  vector<float> &radius2 = ctx.edge_radius2;
+  vector<int> &segment = ctx.edge_segment;
+  radius2.resize(n);
+  segment.resize(n);
+  int counts[kNumFilterSegments+1] = {0};
+  for(int i = 0; i < n; i++) {
+    int angle;
+    if(edges.seed[i] == 0) {
+      angle = edges.angle[i];
+      radius2[i] = edges.radius[i]*edges.radius[i];
+    } else {
+      Point2f offset = edges.pos[i] - center;
+      angle = RayCaster::angleIndexOf(offset.x, offset.y);
+      radius2[i] = offset.x*offset.x + offset.y*offset.y;
+    }
+    segment[i] = angle*kNumFilterSegments/RayCaster::kRayAngles;
+    counts[segment[i]+1]++;
+  }
+
+  // counting sort of the points into their segments
+  for(int s = 0; s < kNumFilterSegments; s++)
+    counts[s+1] += counts[s];
+  vector<int> &order = ctx.edge_order;
+  order.resize(n);
+  int next[kNumFilterSegments];
+  std::copy(counts, counts+kNumFilterSegments, next);
+  for(int i = 0; i < n; i++)
+    order[next[segment[i]]++] = i;
+
+  for(int s = 0; s < kNumFilterSegments; s++) {
+    auto start = order.begin()+counts[s];
+    auto stop = order.begin()+counts[s+1];
+    if(stop == start) continue;
+    auto median = start+(stop-start)/2;
+    std::nth_element(start, median, stop, [&radius2](int a, int b) {
+        return radius2[a] < radius2[b];
+    });
+    goodPoints.push_back(edges.pos[*median]);
+    if(debug) {
+      // (angle in degrees, radius) like the debug view has always shown them
+      for(auto it = start; it != stop; it++) {
+        Point2f offset = edges.pos[*it] - center;
+        Point2f polar(atan2(offset.y, offset.x)*(180.0/PI), sqrt(radius2[*it]));
+        debug->polarPoints.push_back(make_pair(polar, s));
+        if(it == median) debug->polarMedians.push_back(polar);
+      }
+    }
+  }
+}
+
+Point findStarburstSeed(const Mat &m, Mat &validMask) {
+  // Blackest area
+  blur(m, validMask, Size(15,15));
+  Point minLoc;
+  double minVal;
+  minMaxLoc(validMask, &minVal, nullptr, &minLoc, nullptr);
+  threshold(validMask, validMask, minVal*1.5, 255, THRESH_BINARY);
+  return minLoc;
+}
+
+PupilEstimate findEllipseStarburst(StarburstContext &ctx, Mat &m) {
+  INSTRUMENT_STAGE(kStagePupil);
   // Gradient
   // Mat grad_x, grad_y, grad;
   // Mat abs_grad_x, abs_grad_y;
@@ -33,78 +122,86 @@ RotatedRect findEllipseStarburst(Mat &m, const std::string &debugName) {
   // convertScaleAbs( grad_y, abs_grad_y );
   // addWeighted( abs_grad_x, 0.5, abs_grad_y, 0.5, 0, grad );
 
-  // Blackest area
   Mat approxCenter;
-  blur(m, approxCenter, Size(15,15));
   Point minLoc;
-  double minVal;
-  minMaxLoc(approxCenter, &minVal, nullptr, &minLoc, nullptr);
-  threshold(approxCenter, approxCenter, minVal*1.5, 255, THRESH_BINARY);
-
-  starburst_pupil_contour_detection(m, approxCenter, minLoc, starThresh, starRays, 1);
-  std::sort(edge_point.begin(), edge_point.end(), [](Point2f a, Point2f b) {
-      return b.y < a.y;
-  });
-  edge_point.resize((int)(edge_point.size()*(3.0/5.0)));
-
-  Mat polarDebug = Mat::zeros(200,200, CV_8UC3);
-  vector<pair<Point2f,Point2f>> polarPoints;
-  for(Point2f p : edge_point) {
-    Point2f offset = p - Point2f(minLoc.x, minLoc.y);
-    Point2f polar;
-    polar.x = atan2(offset.y, offset.x)*(180.0/PI);
-    polar.y = sqrt(offset.x*offset.x + offset.y*offset.y);
-    // circle(polarDebug, Point(polar.x,polar.y), 1, Scalar(0,255,0));
-    polarPoints.push_back(pair<Point2f,Point2f>(polar, p));
+  {
+    INSTRUMENT_STAGE(kStageSeed);
+    minLoc = findStarburstSeed(m, approxCenter);
   }
-  std::sort(polarPoints.begin(), polarPoints.end(), [](pair<Point2f,Point2f> a, pair<Point2f,Point2f> b) {
-      return a.first.x < b.first.x;
-  });
+  vector<Point2f> &edge_point = ctx.edges.pos;
+  DebugEyeView *debug = ctx.debug;
   vector<Point2f> goodPoints;
-  float segmentSize = polarPoints.size() / (float)(kNumFilterSegments);
-  for(unsigned i = 0; i < kNumFilterSegments; i++) {
-    auto start = polarPoints.begin()+std::min((size_t)std::round(i*segmentSize),polarPoints.size());
-    auto stop = polarPoints.begin()+std::min((size_t)std::round((i+1)*segmentSize),polarPoints.size());
-    if(stop-start == 0) break;
-    std::sort(start, stop, [](pair<Point2f,Point2f> a, pair<Point2f,Point2f> b) {
-        return a.first.y < b.first.y;
-    });
-    auto median = start+(stop-start)/2;
-    goodPoints.push_back((*median).second);
-    for(; start != stop; start++) {
-      circle(polarDebug, Point(start->first.x,start->first.y), 1, Scalar(100,0,100 + (i*50 % 155)));
+  {
+    INSTRUMENT_STAGE(kStageEdges);
+    starburst_pupil_contour_detection(ctx, m, approxCenter, minLoc, starThresh, starRays, 1);
+    keepLowestEdges(ctx);
+    filterEdgeSegments(ctx, goodPoints, debug);
+  }
+
+  // generate and coarsely score the candidates concurrently, each task only writes its own slot
+  RotatedRect candidates[kNumPupilCandidates];
+  float scores[kNumPupilCandidates];
+  auto generate = [&](int i) {
+    INSTRUMENT_STAGE(kStageCandidates);
+    if(i == 0) {
+      int max_inliers_count;
+      free(pupil_fitting_inliers(ctx, m.cols, m.rows, max_inliers_count));
+      double *pupil_param = ctx.pupil_param;
+      candidates[i] = RotatedRect(Point2f(pupil_param[2],pupil_param[3]), Size2f(pupil_param[0]*2,pupil_param[1]*2), pupil_param[4]*180/PI);
+    } else if(i == 1) {
+      if(edge_point.size() >= 5) candidates[i] = fitEllipse(edge_point);
+    } else {
+      if(goodPoints.size() >= 5) candidates[i] = fitEllipse(goodPoints);
     }
-    circle(polarDebug, Point(median->first.x,median->first.y), 2, Scalar(0,255,0));
+    scores[i] = ellipseScore(m, candidates[i], ctx.scoreBuffers[i], kCoarseScoreDelta);
+  };
+  if(ctx.pool) {
+    ctx.pool->parallelFor(kNumPupilCandidates, generate);
+  } else {
+    for(int i = 0; i < kNumPupilCandidates; i++) generate(i);
   }
-  imshow(debugName+"_polar", polarDebug);
-
-
-  int max_inliers_count;
-  pupil_fitting_inliers(m.cols, m.rows, max_inliers_count);
-  RotatedRect fittedIris2(Point2f(pupil_param[2],pupil_param[3]), Size2f(pupil_param[0]*2,pupil_param[1]*2), -pupil_param[4]*180/PI);
-  RotatedRect fittedIris = (edge_point.size() < 5) ? RotatedRect() : fitEllipse(edge_point);
-  RotatedRect fittedIris3 = (goodPoints.size() < 5) ? RotatedRect() : fitEllipse(goodPoints);
-
-  ellipseScore(m, fittedIris3);
-
-  Mat debugImage;
-  cvtColor(m, debugImage, CV_GRAY2RGB);
-  // for(Point2f p : edge_point) {
-  //   Point intPt(p.x, p.y);
-  //   circle(debugImage, intPt, 1, Scalar(0,255,0));
-  // }
-  for(Point2f p : goodPoints) {
-    Point intPt(p.x, p.y);
-    circle(debugImage, intPt, 2, Scalar(0,0,255));
+
+  // once one candidate clearly dominates on the coarse contour the others aren't worth a full score
+  float bestCoarse = *std::max_element(scores, scores+kNumPupilCandidates);
+  int contenders[kNumPupilCandidates];
+  int numContenders = 0;
+  for(int i = 0; i < kNumPupilCandidates; i++) {
+    if(bestCoarse > 0 && scores[i] >= bestCoarse*kDominanceRatio)
+      contenders[numContenders++] = i;
+  }
+  auto refine = [&](int c) {
+    INSTRUMENT_STAGE(kStageRefine);
+    int i = contenders[c];
+    scores[i] = ellipseScore(m, candidates[i], ctx.scoreBuffers[i]);
+  };
+  if(ctx.pool && numContenders > 1) {
+    ctx.pool->parallelFor(numContenders, refine);
+  } else {
+    for(int c = 0; c < numContenders; c++) refine(c);
+  }
+
+  PupilEstimate pupil;
+  float bestScore = 0;
+  for(int c = 0; c < numContenders; c++) {
+    int i = contenders[c];
+    if(scores[i] > bestScore) {
+      bestScore = scores[i];
+      pupil.ellipse = candidates[i];
+    }
   }
-  circle(debugImage, minLoc, 2, Scalar(0,0,255));
-  // ellipse(debugImage, fittedIris2, Scalar(255, 0, 200));
-  ellipse(debugImage, fittedIris, Scalar(255, 255, 0));
-  ellipse(debugImage, fittedIris3, Scalar(0, 255, 255));
-  circle(debugImage, fittedIris3.center, 2, Scalar(0,255, 0));
-  imshow(debugName, debugImage);
-
-  return RotatedRect();
+  pupil.confidence = std::min(bestScore / kConfidentGradient, 1.0f);
+
+  if(debug) {
+    debug->region = m;
+    debug->seed = minLoc;
+    debug->goodPoints = goodPoints;
+    debug->fittedAll = candidates[1];
+    debug->fittedFiltered = candidates[2];
+    debug->pupil = pupil.ellipse;
+    debug->confidence = pupil.confidence;
+  }
+
+  return pupil;
 }
 
 // This project contains code from cvEyeTracker, another GPLv2 project, all code past this point in the file is modified from
@@ -120,29 +217,21 @@ RotatedRect findEllipseStarburst(Mat &m, const std::string &debugName) {
 // All Rights Reserved.
 
 
+#include <algorithm>
 #include <vector>
 #include <cstdint>
 #include <cstdio>
 #include <cstdlib>
-#include "svd.h"
+#include <cstring>
 
 
-void get_5_random_num(int max_num, int* rand_num);
+void get_5_random_num(std::minstd_rand &rng, int max_num, int* rand_num);
+bool solve_conic_5_points(const double* xs, const double* ys, const int* index, double* conic_param);
 bool solve_ellipse(double* conic_param, double* pupil_param);
-Point2f* normalize_edge_point(double &dis_scale, Point2f &nor_center, int ep_num);
+void normalize_edge_point(StarburstContext &ctx, double &dis_scale, Point2f &nor_center, int ep_num);
 void denormalize_ellipse_param(double* par, double* normalized_par, double dis_scale, Point2f nor_center);
 
-
-void locate_edge_points(Mat &m, Mat &validMask, double cx, double cy, int dis, double angle_step, double angle_normal, double angle_spread, int edge_thresh);
-Point2f get_edge_mean();
-
-Point2f* normalize_point_set(Point2f* point_set, double &dis_scale, Point2f &nor_center, int num);
-
-int inliers_num;
-int angle_step = 20;    //20 degrees
-double pupil_param[5] = {0, 0, 0, 0, 0};
-vector <Point2f> edge_point;
-vector <int> edge_intensity_diff;
+Point2f get_edge_mean(StarburstContext &ctx);
 
 
 //------------ Starburst pupil edge detection -----------//
@@ -153,44 +242,46 @@ vector <int> edge_intensity_diff;
 // edge_thresh: best guess for the pupil contour threshold
 // N: number of rays
 // minimum_candidate_features: must return this many features or error
-void starburst_pupil_contour_detection(Mat &m, Mat &validMask, Point2f start_point, int edge_thresh, int N, int minimum_candidate_features) {
+void starburst_pupil_contour_detection(StarburstContext &ctx, Mat &m, Mat &validMask, Point2f start_point, int edge_thresh, int N, int minimum_candidate_features) {
+  EdgePoints &edges = ctx.edges;
   int dis = 7;
   double angle_spread = 100*PI/180;
   int loop_count = 0;
   double angle_step = 2*PI/N;
   double new_angle_step;
-  Point2f edge, edge_mean;
+  Point2f edge_mean;
   double angle_normal;
   double cx = start_point.x;
   double cy = start_point.y;
   int first_ep_num;
+  ctx.caster.setImage(m, validMask);
 
   while (edge_thresh > 5 && loop_count <= 10) {
-    edge_intensity_diff.clear();
-    edge_point.clear();
-    while (edge_point.size() < minimum_candidate_features && edge_thresh > 5) {
-      edge_intensity_diff.clear();
-      edge_point.clear();
-      locate_edge_points(m, validMask, cx, cy, dis, angle_step, 0, 2*PI, edge_thresh);
-      if (edge_point.size() < minimum_candidate_features) {
-        edge_thresh -= 1;
-      }
+    edges.clear();
+    // one sweep gives every ray's rises, so lowering the threshold until enough rays have an edge
+    // is a lookup per threshold rather than another full cast
+    ctx.caster.castProfiles(Point2f(cx, cy), dis, angle_step, 0, 2*PI);
+    while (ctx.caster.raysAbove(edge_thresh) < minimum_candidate_features && edge_thresh > 5) {
+      edge_thresh -= 1;
     }
     if (edge_thresh <= 5) {
       break;
     }
+    // the first seed is the center, the polar filtering in findEllipseStarburst relies on it
+    int center_seed = edges.addSeed(Point2f(cx, cy));
+    ctx.caster.edgesAbove(edges, center_seed, edge_thresh);
 
-    first_ep_num = edge_point.size();
+    first_ep_num = edges.size();
     for (int i = 0; i < first_ep_num; i++) {
-      edge = edge_point.at(i);
-      angle_normal = atan2(cy-edge.y, cx-edge.x);
-      new_angle_step = angle_step*(edge_thresh*1.0/edge_intensity_diff.at(i));
-      locate_edge_points(m, validMask, edge.x, edge.y, dis, new_angle_step, angle_normal,
-angle_spread, edge_thresh);
+      // back towards the center is straight back along the ray the point was found on
+      angle_normal = RayCaster::indexAngle(edges.angle[i] + RayCaster::kRayAngles/2);
+      new_angle_step = angle_step*(edge_thresh*1.0/edges.diff[i]);
+      int seed = edges.addSeed(edges.pos[i]);
+      ctx.caster.cast(edges, seed, dis, new_angle_step, angle_normal, angle_spread, edge_thresh);
     }
 
     loop_count += 1;
-    edge_mean = get_edge_mean();
+    edge_mean = get_edge_mean(ctx);
     if (fabs(edge_mean.x-cx) + fabs(edge_mean.y-cy) < 10)
       break;
 
@@ -199,54 +290,20 @@ angle_spread, edge_thresh);
   }
 
   if (loop_count > 10) {
-    edge_point.clear();
+    edges.clear();
     printf("Error! edge points did not converge in %d iterations!\n", loop_count);
     return;
   }
 
   if (edge_thresh <= 5) {
-    edge_point.clear();
+    edges.clear();
     printf("Error! Adaptive threshold is too low!\n");
     return;
   }
 }
 
-void locate_edge_points(Mat &m, Mat &validMask, double cx, double cy, int dis, double angle_step, double angle_normal, double angle_spread, int edge_thresh) {
-  double angle;
-  Point2f p, edge;
-  double dis_cos, dis_sin;
-  uint8_t pixel_value1, pixel_value2;
-
-  for (angle = angle_normal-angle_spread/2+0.0001; angle < angle_normal+angle_spread/2; angle += angle_step) {
-    dis_cos = dis * cos(angle);
-    dis_sin = dis * sin(angle);
-    p.x = cx + dis_cos;
-    p.y = cy + dis_sin;
-
-    if (p.x < 0 || p.x >= m.cols || p.y < 0 || p.y >= m.rows)
-      continue;
-    pixel_value1 = m.at<uint8_t>((int)(p.y), (int)(p.x));
-    while (1) {
-      p.x += dis_cos;
-      p.y += dis_sin;
-      if (p.x < 0 || p.x >= m.cols || p.y < 0 || p.y >= m.rows)
-        break;
-
-      pixel_value2 = m.at<uint8_t>((int)(p.y), (int)(p.x));
-      bool is_valid = validMask.at<uint8_t>((int)(p.y - dis_sin/2), (int)(p.x - dis_cos/2)) > 0;
-      if (pixel_value2 - pixel_value1 > edge_thresh && is_valid) {
-        edge.x = p.x - dis_cos/2;
-        edge.y = p.y - dis_sin/2;
-        edge_point.push_back(edge);
-        edge_intensity_diff.push_back(pixel_value2 - pixel_value1);
-        break;
-      }
-      pixel_value1 = pixel_value2;
-    }
-  }
-}
-
-Point2f get_edge_mean() {
+Point2f get_edge_mean(StarburstContext &ctx) {
+  const vector<Point2f> &edge_point = ctx.edges.pos;
   Point2f edge;
   int i;
   double sumx=0, sumy=0;
@@ -268,7 +325,7 @@ Point2f get_edge_mean() {
 
 //------------ Ransac ellipse fitting -----------//
 // Randomly select 5 indeics
-void get_5_random_num(int max_num, int* rand_num) {
+void get_5_random_num(std::minstd_rand &rng, int max_num, int* rand_num) {
   int rand_index = 0;
   int r;
   int i;
@@ -283,7 +340,7 @@ void get_5_random_num(int max_num, int* rand_num) {
 
   while (rand_index < 5) {
     is_new = 1;
-    r = (int)((rand()*1.0/RAND_MAX) * max_num);
+    r = (int)(((rng()-rng.min())*1.0/(rng.max()-rng.min())) * max_num);
     for (i = 0; i < rand_index; i++) {
       if (r == rand_num[i]) {
         is_new = 0;
@@ -298,6 +355,71 @@ void get_5_random_num(int max_num, int* rand_num) {
 }
 
 
+// solve_conic_5_points
+// finds the conic through the 5 points (xs,ys)[index[0..4]], the null vector of the 5x6 system
+// [x^2 xy y^2 x y 1] * conic_param = 0 by Gaussian elimination with full pivoting, normalized to unit length.
+// Same as the smallest singular vector of the system up to sign, without the general SVD.
+// Returns false if the points don't determine a unique conic (e.g. repeated points).
+bool solve_conic_5_points(const double* xs, const double* ys, const int* index, double* conic_param) {
+  double A[5][6];
+  for (int i = 0; i < 5; i++) {
+    double x = xs[index[i]];
+    double y = ys[index[i]];
+    A[i][0] = x*x;
+    A[i][1] = x*y;
+    A[i][2] = y*y;
+    A[i][3] = x;
+    A[i][4] = y;
+    A[i][5] = 1;
+  }
+
+  // col[k] is the unknown eliminated at step k, col[5] ends up as the free one
+  int col[6] = {0, 1, 2, 3, 4, 5};
+  for (int k = 0; k < 5; k++) {
+    int pivot_row = k, pivot_col = k;
+    double best = 0;
+    for (int i = k; i < 5; i++) {
+      for (int j = k; j < 6; j++) {
+        double v = fabs(A[i][col[j]]);
+        if (v > best) {
+          best = v;
+          pivot_row = i;
+          pivot_col = j;
+        }
+      }
+    }
+    if (best < 1e-12)
+      return false;
+    if (pivot_row != k) {
+      for (int j = 0; j < 6; j++)
+        std::swap(A[k][j], A[pivot_row][j]);
+    }
+    std::swap(col[k], col[pivot_col]);
+    for (int i = k+1; i < 5; i++) {
+      double factor = A[i][col[k]] / A[k][col[k]];
+      for (int j = k+1; j < 6; j++)
+        A[i][col[j]] -= factor*A[k][col[j]];
+    }
+  }
+
+  double v[6];
+  v[col[5]] = 1;
+  for (int k = 4; k >= 0; k--) {
+    double sum = A[k][col[5]];
+    for (int j = k+1; j < 5; j++)
+      sum += A[k][col[j]]*v[col[j]];
+    v[col[k]] = -sum / A[k][col[k]];
+  }
+
+  double norm = 0;
+  for (int i = 0; i < 6; i++)
+    norm += v[i]*v[i];
+  norm = sqrt(norm);
+  for (int i = 0; i < 6; i++)
+    conic_param[i] = v[i] / norm;
+  return true;
+}
+
 // solve_ellipse
 // conic_param[6] is the parameters of a conic {a, b, c, d, e, f}; conic equation: ax^2 + bxy + cy^2 + dx + ey + f = 0;
 // ellipse_param[5] is the parameters of an ellipse {ellipse_a, ellipse_b, cx, cy, theta}; a & b is the major or minor axis;
@@ -340,7 +462,9 @@ bool solve_ellipse(double* conic_param, double* ellipse_param) {
   return 1;
 }
 
-Point2f* normalize_edge_point(double &dis_scale, Point2f &nor_center, int ep_num) {
+// normalizes the edge points into ctx.nor_x/ctx.nor_y, and the float copies when scoring in single precision
+void normalize_edge_point(StarburstContext &ctx, double &dis_scale, Point2f &nor_center, int ep_num) {
+  const vector<Point2f> &edge_point = ctx.edges.pos;
   double sumx = 0, sumy = 0;
   double sumdis = 0;
   Point2f edge;
@@ -355,13 +479,17 @@ Point2f* normalize_edge_point(double &dis_scale, Point2f &nor_center, int ep_num
   dis_scale = sqrt((double)2)*ep_num/sumdis;
   nor_center.x = sumx*1.0/ep_num;
   nor_center.y = sumy*1.0/ep_num;
-  Point2f *edge_point_nor = (Point2f*)malloc(sizeof(Point2f)*ep_num);
+  ctx.nor_x.resize(ep_num);
+  ctx.nor_y.resize(ep_num);
   for (i = 0; i < ep_num; i++) {
     edge = edge_point.at(i);
-    edge_point_nor[i].x = (edge.x - nor_center.x)*dis_scale;
-    edge_point_nor[i].y = (edge.y - nor_center.y)*dis_scale;
+    ctx.nor_x[i] = (edge.x - nor_center.x)*dis_scale;
+    ctx.nor_y[i] = (edge.y - nor_center.y)*dis_scale;
+  }
+  if (ctx.single_precision) {
+    ctx.nor_xf.assign(ctx.nor_x.begin(), ctx.nor_x.end());
+    ctx.nor_yf.assign(ctx.nor_y.begin(), ctx.nor_y.end());
   }
-  return edge_point_nor;
 }
 
 void denormalize_ellipse_param(double* par, double* normalized_par, double dis_scale, Point2f nor_center) {
@@ -371,8 +499,69 @@ void denormalize_ellipse_param(double* par, double* normalized_par, double dis_s
     par[3] = normalized_par[3] / dis_scale + nor_center.y;
 }
 
-int* pupil_fitting_inliers(int width, int height,  int &return_max_inliers_num) {
-  int i;
+// number of hypotheses scored together in one pass over the edge points
+static const int kHypothesisBatch = 4;
+// most hypotheses generated before the adaptive stopping rule is checked again, a multiple of kHypothesisBatch
+static const int kRansacRound = 64;
+
+// hypothesis_seed
+// seed for the sample stream of RANSAC hypothesis k, a splitmix64 step so neighbouring hypotheses get unrelated streams
+static uint32_t hypothesis_seed(uint32_t base, int k) {
+  uint64_t z = ((uint64_t)base << 32 | (uint32_t)k) + 0x9e3779b97f4a7c15ULL;
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+  return (uint32_t)(z ^ (z >> 31));
+}
+
+// count_conic_inliers
+// counts for each of the kHypothesisBatch conics how many points have an algebraic error below threshold.
+// The points are loaded once per batch rather than once per hypothesis, and with them in separate x and y
+// arrays and the hypotheses unrolled the loop compiles to straight vector code, the counts being sums of
+// comparison results. T is double, or float to fit twice as many points in a vector register.
+template<typename T>
+static void count_conic_inliers(const T* xs, const T* ys, int num, const double conic_par[][6], double threshold, int* counts) {
+  T c[kHypothesisBatch][6];
+  for (int h = 0; h < kHypothesisBatch; h++)
+    for (int k = 0; k < 6; k++)
+      c[h][k] = (T)conic_par[h][k];
+  const T thresh = (T)threshold;
+  int n[kHypothesisBatch] = {0};
+  for (int i = 0; i < num; i++) {
+    T x = xs[i], y = ys[i];
+    T xx = x*x, xy = x*y, yy = y*y;
+    for (int h = 0; h < kHypothesisBatch; h++) {
+      T e = c[h][0]*xx + c[h][1]*xy + c[h][2]*yy + c[h][3]*x + c[h][4]*y + c[h][5];
+      n[h] += std::abs(e) < thresh;
+    }
+  }
+  for (int h = 0; h < kHypothesisBatch; h++)
+    counts[h] = n[h];
+}
+
+// collect_conic_inliers
+// writes the indices of the points count_conic_inliers would count for conic_par, returning how many there are
+template<typename T>
+static int collect_conic_inliers(const T* xs, const T* ys, int num, const double* conic_par, double threshold, int* index) {
+  T c[6];
+  for (int k = 0; k < 6; k++)
+    c[k] = (T)conic_par[k];
+  const T thresh = (T)threshold;
+  int n = 0;
+  for (int i = 0; i < num; i++) {
+    T x = xs[i], y = ys[i];
+    T xx = x*x, xy = x*y, yy = y*y;
+    T e = c[0]*xx + c[1]*xy + c[2]*yy + c[3]*x + c[4]*y + c[5];
+    if (std::abs(e) < thresh)
+      index[n++] = i;
+  }
+  return n;
+}
+
+int* pupil_fitting_inliers(StarburstContext &ctx, int width, int height,  int &return_max_inliers_num) {
+  INSTRUMENT_STAGE(kStageRansac);
+  const vector<Point2f> &edge_point = ctx.edges.pos;
+  double *pupil_param = ctx.pupil_param;
+  int i, h;
   int ep_num = edge_point.size();   //ep stands for edge point
   Point2f nor_center;
   double dis_scale;
@@ -380,127 +569,107 @@ int* pupil_fitting_inliers(int width, int height,  int &return_max_inliers_num)
   int ellipse_point_num = 5;  //number of point that needed to fit an ellipse
   if (ep_num < ellipse_point_num) {
     printf("Error! %d points are not enough to fit ellipse\n", ep_num);
-    memset(pupil_param, 0, sizeof(pupil_param));
+    memset(pupil_param, 0, sizeof(ctx.pupil_param));
     return_max_inliers_num = 0;
     return NULL;
   }
 
   //Normalization
-  Point2f *edge_point_nor = normalize_edge_point(dis_scale, nor_center, ep_num);
+  normalize_edge_point(ctx, dis_scale, nor_center, ep_num);
+  const double *nor_x = ctx.nor_x.data();
+  const double *nor_y = ctx.nor_y.data();
 
   //Ransac
-  int *inliers_index = (int*)malloc(sizeof(int)*ep_num);
-  int *max_inliers_index = (int*)malloc(sizeof(int)*ep_num);
-  int ninliers = 0;
   int max_inliers = 0;
   int sample_num = 1000;  //number of sample
   int ransac_count = 0;
   double dis_threshold = sqrt(3.84)*dis_scale;
-  double dis_error;
-
-  memset(inliers_index, int(0), sizeof(int)*ep_num);
-  memset(max_inliers_index, int(0), sizeof(int)*ep_num);
-  int rand_index[5];
-  double A[6][6];
-  int M = 6, N = 6; //M is row; N is column
-  for (i = 0; i < N; i++) {
-    A[i][5] = 1;
-    A[5][i] = 0;
-  }
-  double **ppa = (double**)malloc(sizeof(double*)*M);
-  double **ppu = (double**)malloc(sizeof(double*)*M);
-  double **ppv = (double**)malloc(sizeof(double*)*N);
-  for (i = 0; i < M; i++) {
-    ppa[i] = A[i];
-    ppu[i] = (double*)malloc(sizeof(double)*N);
-  }
-  for (i = 0; i < N; i++) {
-    ppv[i] = (double*)malloc(sizeof(double)*N);
-  }
-  double pd[6];
-  int min_d_index;
-  double conic_par[6] = {0};
+
+  // Hypotheses are generated in rounds of batches that can be spread over the thread pool. Each
+  // hypothesis samples from its own stream seeded by its index, so which thread scores it doesn't matter,
+  // and the round is then reduced in hypothesis order exactly as a serial loop would, stopping rule included.
+  uint32_t stream_base = ctx.rng();
+  double conic_par[kRansacRound][6];
+  bool conic_valid[kRansacRound];
+  int ninliers[kRansacRound];
+  double best_conic_par[6] = {0};
   double ellipse_par[5] = {0};
   double best_ellipse_par[5] = {0};
   double ratio;
-  while (sample_num > ransac_count) {
-    get_5_random_num((ep_num-1), rand_index);
-
-    //svd decomposition to solve the ellipse parameter
-    for (i = 0; i < 5; i++) {
-      A[i][0] = edge_point_nor[rand_index[i]].x * edge_point_nor[rand_index[i]].x;
-      A[i][1] = edge_point_nor[rand_index[i]].x * edge_point_nor[rand_index[i]].y;
-      A[i][2] = edge_point_nor[rand_index[i]].y * edge_point_nor[rand_index[i]].y;
-      A[i][3] = edge_point_nor[rand_index[i]].x;
-      A[i][4] = edge_point_nor[rand_index[i]].y;
-    }
-
-    svd(M, N, ppa, ppu, pd, ppv);
-    min_d_index = 0;
-    for (i = 1; i < N; i++) {
-      if (pd[i] < pd[min_d_index])
-        min_d_index = i;
-    }
-
-    for (i = 0; i < N; i++)
-      conic_par[i] = ppv[i][min_d_index]; //the column of v that corresponds to the smallest singular value,
-                                                //which is the solution of the equations
-    ninliers = 0;
-    memset(inliers_index, 0, sizeof(int)*ep_num);
-    for (i = 0; i < ep_num; i++) {
-      dis_error = conic_par[0]*edge_point_nor[i].x*edge_point_nor[i].x +
-                  conic_par[1]*edge_point_nor[i].x*edge_point_nor[i].y +
-                  conic_par[2]*edge_point_nor[i].y*edge_point_nor[i].y +
-                  conic_par[3]*edge_point_nor[i].x + conic_par[4]*edge_point_nor[i].y + conic_par[5];
-      if (fabs(dis_error) < dis_threshold) {
-        inliers_index[ninliers] = i;
-        ninliers++;
+  bool exceeded = false;
+  while (sample_num > ransac_count && !exceeded) {
+    // a batch per thread and no more than the stopping rule could still want, so serial fits don't do extra work.
+    // How the hypotheses are split into rounds doesn't change the fit.
+    int remaining = std::min(sample_num, 1501) - ransac_count;
+    int num_batches = std::min((remaining + kHypothesisBatch - 1) / kHypothesisBatch, kRansacRound / kHypothesisBatch);
+    num_batches = std::min(num_batches, ctx.pool ? ctx.pool->numThreads() : 1);
+    int round_start = ransac_count;
+    auto score_batch = [&](int b) {
+      double (*batch_par)[6] = conic_par + b*kHypothesisBatch;
+      for (int h = 0; h < kHypothesisBatch; h++) {
+        std::minstd_rand rng(hypothesis_seed(stream_base, round_start + b*kHypothesisBatch + h));
+        int rand_index[5];
+        get_5_random_num(rng, (ep_num-1), rand_index);
+        //solve for the conic through the 5 points, skipping degenerate samples
+        conic_valid[b*kHypothesisBatch + h] = solve_conic_5_points(nor_x, nor_y, rand_index, batch_par[h]);
+        if (!conic_valid[b*kHypothesisBatch + h])
+          memset(batch_par[h], 0, sizeof(batch_par[h]));
       }
+      if (ctx.single_precision)
+        count_conic_inliers(ctx.nor_xf.data(), ctx.nor_yf.data(), ep_num, batch_par, dis_threshold, ninliers + b*kHypothesisBatch);
+      else
+        count_conic_inliers(nor_x, nor_y, ep_num, batch_par, dis_threshold, ninliers + b*kHypothesisBatch);
+    };
+    if (ctx.pool && num_batches > 1) {
+      ctx.pool->parallelFor(num_batches, score_batch);
+    } else {
+      for (int b = 0; b < num_batches; b++)
+        score_batch(b);
     }
 
-    if (ninliers > max_inliers) {
-      if (solve_ellipse(conic_par, ellipse_par)) {
-        denormalize_ellipse_param(ellipse_par, ellipse_par, dis_scale, nor_center);
-        ratio = ellipse_par[0] / ellipse_par[1];
-        if (ellipse_par[2] > 0 && ellipse_par[2] <= width-1 && ellipse_par[3] > 0 && ellipse_par[3] <= height-1 &&
-            ratio > 0.5 && ratio < 2) {
-          memcpy(max_inliers_index, inliers_index, sizeof(int)*ep_num);
-          for (i = 0; i < 5; i++) {
-            best_ellipse_par[i] = ellipse_par[i];
+    // consume the hypotheses in sample order, the first of equally good ones wins
+    for (h = 0; h < num_batches*kHypothesisBatch && sample_num > ransac_count; h++) {
+      if (conic_valid[h] && ninliers[h] > max_inliers) {
+        if (solve_ellipse(conic_par[h], ellipse_par)) {
+          denormalize_ellipse_param(ellipse_par, ellipse_par, dis_scale, nor_center);
+          ratio = ellipse_par[0] / ellipse_par[1];
+          if (ellipse_par[2] > 0 && ellipse_par[2] <= width-1 && ellipse_par[3] > 0 && ellipse_par[3] <= height-1 &&
+              ratio > 0.5 && ratio < 2) {
+            memcpy(best_conic_par, conic_par[h], sizeof(best_conic_par));
+            for (i = 0; i < 5; i++) {
+              best_ellipse_par[i] = ellipse_par[i];
+            }
+            max_inliers = ninliers[h];
+            sample_num = (int)(log((double)(1-0.99))/log(1.0-pow(ninliers[h]*1.0/ep_num, 5)));
           }
-          max_inliers = ninliers;
-          sample_num = (int)(log((double)(1-0.99))/log(1.0-pow(ninliers*1.0/ep_num, 5)));
         }
       }
-    }
-    ransac_count++;
-    if (ransac_count > 1500) {
-      printf("Error! ransac_count exceed! ransac break! sample_num=%d, ransac_count=%d\n", sample_num, ransac_count);
-      break;
+      ransac_count++;
+      if (ransac_count > 1500) {
+        printf("Error! ransac_count exceed! ransac break! sample_num=%d, ransac_count=%d\n", sample_num, ransac_count);
+        exceeded = true;
+        break;
+      }
     }
   }
   //INFO("ransc end\n");
+  int *max_inliers_index = NULL;
   if (best_ellipse_par[0] > 0 && best_ellipse_par[1] > 0) {
     for (i = 0; i < 5; i++) {
       pupil_param[i] = best_ellipse_par[i];
     }
+    // only the winner's inliers are ever needed, so they are listed once at the end
+    max_inliers_index = (int*)malloc(sizeof(int)*ep_num);
+    if (ctx.single_precision)
+      max_inliers = collect_conic_inliers(ctx.nor_xf.data(), ctx.nor_yf.data(), ep_num, best_conic_par, dis_threshold, max_inliers_index);
+    else
+      max_inliers = collect_conic_inliers(nor_x, nor_y, ep_num, best_conic_par, dis_threshold, max_inliers_index);
   } else {
-    memset(pupil_param, 0, sizeof(pupil_param));
+    memset(pupil_param, 0, sizeof(ctx.pupil_param));
     max_inliers = 0;
-    free(max_inliers_index);
-    max_inliers_index = NULL;
-  }
-
-  for (i = 0; i < M; i++) {
-    free(ppu[i]);
-    free(ppv[i]);
   }
-  free(ppu);
-  free(ppv);
-  free(ppa);
 
-  free(edge_point_nor);
-  free(inliers_index);
+  ctx.inliers_num = max_inliers;
   return_max_inliers_num = max_inliers;
   return max_inliers_index;
 }
@@ -5,10 +5,70 @@
 #define STARBURST_H__
 
 #include <opencv2/imgproc/imgproc.hpp>
+#include <random>
 #include <string>
+#include <vector>
+
+#include "ellipse.h"
+#include "rayCast.h"
 
 extern int starThresh;
 extern int starRays;
-cv::RotatedRect findEllipseStarburst(cv::Mat &m, const std::string &debugName);
+
+struct DebugEyeView;
+class ThreadPool;
+
+// the RANSAC fit, a fit to every edge point and a fit to the segment medians
+static const int kNumPupilCandidates = 3;
+
+// Everything the starburst and RANSAC stages used to keep in globals, so that
+// several eyes can be processed at once with one context each.
+struct StarburstContext {
+  EdgePoints edges;
+  RayCaster caster;
+  // scratch for filtering edges
+  std::vector<int> edge_order, edge_segment;
+  std::vector<float> edge_radius2;
+  EllipseScoreBuffers scoreBuffers[kNumPupilCandidates]; // one per pupil candidate so they can be scored at once
+  // normalized edge points for RANSAC, x and y kept apart so hypotheses can be scored with vector code
+  std::vector<double> nor_x, nor_y;
+  std::vector<float> nor_xf, nor_yf; // only filled in when single_precision
+  double pupil_param[5];
+  int inliers_num;
+  // advanced once per RANSAC fit to seed that fit's sample streams, seed it for reproducible fits
+  std::minstd_rand rng;
+  // splits RANSAC hypotheses over its workers when non-null, the fit is the same for any number of threads
+  ThreadPool *pool;
+  // score RANSAC hypotheses in float instead of double, points right on the inlier threshold may be counted differently
+  bool single_precision;
+
+  // filled in for the debug view when non-null
+  DebugEyeView *debug;
+
+  StarburstContext() : pupil_param(), inliers_num(0), pool(nullptr), single_precision(false), debug(nullptr) {}
+};
+
+struct PupilEstimate {
+  cv::RotatedRect ellipse;
+  // how clearly the image steps up across the ellipse, 0 when no pupil was found and 1 for a crisp edge
+  float confidence;
+  PupilEstimate() : confidence(0) {}
+};
+
+// Finds the pupil in an 8 bit eye region, in the region's coordinates.
+PupilEstimate findEllipseStarburst(StarburstContext &ctx, cv::Mat &m);
+
+// The stages of findEllipseStarburst, exposed for benchmarking.
+// Returns the darkest spot of the blurred region to cast rays from. validMask is set to 255 where
+// the blurred region is brighter than 1.5 times that minimum, where edge points are accepted.
+cv::Point findStarburstSeed(const cv::Mat &m, cv::Mat &validMask);
+// Casts N rays from start_point and collects the pupil edge points into ctx.edges.
+void starburst_pupil_contour_detection(StarburstContext &ctx, cv::Mat &m, cv::Mat &validMask, cv::Point2f start_point, int edge_thresh, int N, int minimum_candidate_features);
+// Solves for the conic through the 5 points picked out by index, false if they are degenerate.
+bool solve_conic_5_points(const double* xs, const double* ys, const int* index, double* conic_param);
+
+// RANSAC ellipse fit to ctx.edges.pos, the result is left in ctx.pupil_param.
+// Returns the malloc'd indices of the inliers of the best fit, or null if there isn't one.
+int* pupil_fitting_inliers(StarburstContext &ctx, int width, int height, int &return_max_inliers);
 
 #endif
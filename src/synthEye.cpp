@@ -0,0 +1,185 @@
+// The SmartGaze Eye Tracker
+// Copyright (C) 2016  Tristan Hume
+// Released under GPLv2, see LICENSE file for full text
+
+#include "synthEye.h"
+#include "frameSource.h"
+
+#include <algorithm>
+#include <math.h>
+
+using namespace cv;
+
+static const float kPi = 3.14159265f;
+
+// 10 bit brightness of everything in the scene under the tracker's infrared lights
+static const float kSkinLevel = 380;
+static const float kSkinFalloff = 3.5e-7f; // vignetting towards the frame corners, per squared pixel
+static const float kHairLevel = 55;
+static const float kLidLineLevel = 250;     // lashes along the lid edges
+static const float kScleraLevel = 430;
+static const float kIrisLevel = 210;
+static const float kPupilLevel = 45;
+static const float kGlintLevel = 1400;      // the centre of a glint saturates the sensor
+static const float kHighlightLevel = 900;
+
+// geometry in full resolution pixels
+static const Point2f kEyeCenters[2] = {Point2f(540, 540), Point2f(1000, 548)};
+static const float kEyeHalfWidth = 105; // center to corner
+static const float kIrisRadius = 52;
+static const float kGazeReach = 26;     // how far the iris moves at the edge of the gaze range
+static const float kGlintReach = 0.4f;  // glints move this much less than the pupil with gaze
+static const float kGlintSpacing = 16;  // between the two lights' reflections
+static const float kGlintSigma = 1.3f;
+static const float kHairline = 170;
+static const int kNumHairHighlights = 160;
+
+static float smoothstep(float edge0, float edge1, float x) {
+  float t = std::min(std::max((x-edge0)/(edge1-edge0), 0.0f), 1.0f);
+  return t*t*(3-2*t);
+}
+
+// blends a over b by coverage c
+static float mix(float b, float a, float c) {
+  return b + (a-b)*c;
+}
+
+SyntheticScene::SyntheticScene(unsigned seed) : rng(seed), frameIndex(0), head(0,0), gaze(0,0), gazeTarget(0,0),
+                                                nextSaccade(0), noiseSigma(3) {
+  std::uniform_real_distribution<float> phase(0, 2*kPi);
+  headPhase[0] = phase(rng);
+  headPhase[1] = phase(rng);
+  // well inside the hair however the hairline moves, and off the top rows where the glint scan
+  // can't check the neighbourhood
+  std::uniform_real_distribution<float> x(0, kCaptureWidth), y(24, kHairline-50), radius(0.8f, 2.2f);
+  for(int i = 0; i < kNumHairHighlights; ++i)
+    hairHighlights.push_back(Point3f(x(rng), y(rng), radius(rng)));
+}
+
+static void advanceScene(SyntheticScene &s) {
+  std::uniform_real_distribution<float> unit(-1, 1);
+  if(s.frameIndex >= s.nextSaccade) {
+    do {
+      s.gazeTarget = Point2f(unit(s.rng), unit(s.rng));
+    } while(s.gazeTarget.dot(s.gazeTarget) > 1);
+    s.nextSaccade = s.frameIndex + 15 + (int)(s.rng() % 45);
+  }
+  // saccades take a few frames
+  s.gaze += (s.gazeTarget - s.gaze)*0.45f;
+
+  float t = s.frameIndex/(float)kCaptureFPS;
+  s.head = Point2f(30*sinf(2*kPi*t/7 + s.headPhase[0]), 15*sinf(2*kPi*t/11 + s.headPhase[1]));
+  float pupilRadius = 19 + 5*sinf(2*kPi*t/9 + s.headPhase[1]);
+  float upperLid = 36 + 9*sinf(2*kPi*t/5 + s.headPhase[0]);
+  float lowerLid = 38 + 4*sinf(2*kPi*t/6);
+
+  for(int e = 0; e < 2; ++e) {
+    SyntheticEye &eye = s.eyes[e];
+    Point2f center = kEyeCenters[e] + s.head;
+    eye.irisCenter = center + s.gaze*kGazeReach;
+    eye.irisRadius = kIrisRadius;
+    eye.upperLid = upperLid;
+    eye.lowerLid = lowerLid;
+    // the pupil foreshortens along the direction of gaze
+    float amount = sqrtf(s.gaze.dot(s.gaze));
+    float angle = atan2f(s.gaze.y, s.gaze.x)*180/kPi;
+    eye.pupil = RotatedRect(eye.irisCenter, Size2f(2*pupilRadius*(1-0.22f*amount), 2*pupilRadius), angle);
+    Point2f glintCenter = center + s.gaze*(kGazeReach*kGlintReach) + Point2f(0, 0.3f*kIrisRadius);
+    eye.glints[0] = glintCenter - Point2f(kGlintSpacing/2, 0);
+    eye.glints[1] = glintCenter + Point2f(kGlintSpacing/2, 0);
+    // the lid is highest in the middle of the eye, where the pupil is
+    float dx = (eye.irisCenter.x - center.x)/kEyeHalfWidth;
+    float lidTop = center.y - upperLid*(1-dx*dx);
+    eye.pupilOccluded = eye.irisCenter.y - pupilRadius < lidTop;
+  }
+  s.frameIndex++;
+}
+
+// Brightness of one eye at p, or the skin level when p is outside the eye opening.
+// Edges are antialiased over about a pixel so sub pixel fits have something to find.
+static float shadeEye(const SyntheticEye &eye, Point2f center, Point2f p, float skin) {
+  float dx = (p.x-center.x)/kEyeHalfWidth;
+  if(fabsf(dx) >= 1) return skin;
+  float shape = 1-dx*dx;
+  float top = center.y - eye.upperLid*shape, bottom = center.y + eye.lowerLid*shape;
+  // signed distance into the opening, positive inside
+  float inside = std::min(p.y-top, bottom-p.y);
+  if(inside < -3) return skin;
+
+  float v = kScleraLevel;
+  Point2f d = p - eye.irisCenter;
+  float r = sqrtf(d.dot(d));
+  // a little radial texture in the iris so it isn't a flat disc
+  float iris = kIrisLevel + 12*sinf(atan2f(d.y, d.x)*23 + r*0.3f);
+  v = mix(v, iris, smoothstep(eye.irisRadius+0.7f, eye.irisRadius-0.7f, r));
+
+  // distance to the pupil ellipse measured in the ellipse's own frame
+  float a = eye.pupil.size.width/2, b = eye.pupil.size.height/2;
+  float angle = eye.pupil.angle*kPi/180;
+  float u = d.x*cosf(angle) + d.y*sinf(angle), w = -d.x*sinf(angle) + d.y*cosf(angle);
+  float q = sqrtf((u*u)/(a*a) + (w*w)/(b*b));
+  float pupilEdge = (q-1)*std::min(a, b);
+  v = mix(v, kPupilLevel, smoothstep(0.7f, -0.7f, pupilEdge));
+
+  for(const Point2f &g : eye.glints) {
+    Point2f dg = p - g;
+    v += kGlintLevel*expf(-dg.dot(dg)/(2*kGlintSigma*kGlintSigma));
+  }
+
+  // lashes darken the lid edges, then the lids cover everything outside the opening
+  float lash = smoothstep(4, 0, fabsf(inside));
+  v = mix(v, kLidLineLevel, lash*0.6f);
+  return mix(skin, v, smoothstep(-1, 1, inside));
+}
+
+void renderSyntheticFrame(SyntheticScene &s, Mat &frame) {
+  advanceScene(s);
+  frame.create(kCaptureHeight, kCaptureWidth, CV_16UC1);
+  Point2f head = s.head;
+  Point2f eyeCenters[2] = {kEyeCenters[0] + head, kEyeCenters[1] + head};
+  Rect eyeBoxes[2];
+  for(int e = 0; e < 2; ++e)
+    eyeBoxes[e] = Rect(eyeCenters[e].x - kEyeHalfWidth - 2, eyeCenters[e].y - 60, 2*kEyeHalfWidth + 4, 120);
+
+  std::normal_distribution<float> noise(0, 1);
+  std::vector<float> row(frame.cols);
+  for(int i = 0; i < frame.rows; ++i) {
+    float y = i + 0.5f;
+    for(int j = 0; j < frame.cols; ++j) {
+      float x = j + 0.5f;
+      float fx = x - kCaptureWidth/2, fy = y - kCaptureHeight/2;
+      float skin = kSkinLevel*(1 - kSkinFalloff*(fx*fx + fy*fy));
+      float hairEdge = kHairline + head.y + 30*sinf((x - head.x)/190);
+      float hair = kHairLevel + 15*sinf((x - head.x)*0.35f + y*0.04f);
+      float v = mix(skin, hair, smoothstep(hairEdge+3, hairEdge-3, y));
+      row[j] = v;
+    }
+    for(int e = 0; e < 2; ++e) {
+      const Rect &box = eyeBoxes[e];
+      if(i < box.y || i >= box.y + box.height) continue;
+      for(int j = std::max(box.x, 0); j < std::min(box.x + box.width, frame.cols); ++j)
+        row[j] = shadeEye(s.eyes[e], eyeCenters[e], Point2f(j + 0.5f, y), row[j]);
+    }
+    uint16_t *Fi = frame.ptr<uint16_t>(i);
+    for(int j = 0; j < frame.cols; ++j) {
+      float v = row[j];
+      // shot noise grows with the signal, read noise doesn't
+      v += noise(s.rng)*sqrtf(s.noiseSigma*s.noiseSigma + 0.04f*std::max(v, 0.0f));
+      Fi[j] = (uint16_t)std::min(std::max(v + 0.5f, 0.0f), 1023.0f);
+    }
+  }
+
+  // specular highlights off hair, bright enough to pass the glint threshold but in a dark neighbourhood
+  for(const Point3f &h : s.hairHighlights) {
+    Point2f c(h.x + head.x, h.y + head.y);
+    int r = (int)ceilf(h.z*2);
+    for(int i = std::max(0, (int)c.y - r); i <= std::min(frame.rows-1, (int)c.y + r); ++i) {
+      uint16_t *Fi = frame.ptr<uint16_t>(i);
+      for(int j = std::max(0, (int)c.x - r); j <= std::min(frame.cols-1, (int)c.x + r); ++j) {
+        float dx = j + 0.5f - c.x, dy = i + 0.5f - c.y;
+        float v = Fi[j] + kHighlightLevel*expf(-(dx*dx + dy*dy)/(2*h.z*h.z));
+        Fi[j] = (uint16_t)std::min(v, 1023.0f);
+      }
+    }
+  }
+}
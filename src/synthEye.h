@@ -0,0 +1,44 @@
+// The SmartGaze Eye Tracker
+// Copyright (C) 2016  Tristan Hume
+// Released under GPLv2, see LICENSE file for full text
+#ifndef SYNTHEYE_H__
+#define SYNTHEYE_H__
+
+#include <opencv2/imgproc/imgproc.hpp>
+#include <random>
+#include <vector>
+
+// Renders frames like the Eye Tribe's camera delivers, with the true pupil of every eye known,
+// so changes to tracking can be checked for accuracy as well as speed.
+
+// The ground truth of one eye, in full resolution frame pixels.
+struct SyntheticEye {
+  cv::RotatedRect pupil;
+  cv::Point2f irisCenter;
+  float irisRadius;
+  cv::Point2f glints[2];
+  float upperLid, lowerLid; // how far the lids open above and below the eye's center line
+  bool pupilOccluded;       // part of the pupil is under a lid
+};
+
+// A face in front of the tracker that moves a little from frame to frame: the head drifts,
+// the eyes make saccades and the pupils dilate and contract, all driven by one seeded stream.
+struct SyntheticScene {
+  std::minstd_rand rng;
+  int frameIndex;
+  float headPhase[2];
+  cv::Point2f head;             // offset of the whole face from its rest position
+  cv::Point2f gaze, gazeTarget; // -1 to 1 in each direction
+  int nextSaccade;              // frame the gaze next jumps at
+  std::vector<cv::Point3f> hairHighlights; // x, y relative to the head and radius
+  float noiseSigma;              // read noise in 10 bit levels, on top of shot noise
+  SyntheticEye eyes[2];          // truth for the last rendered frame, left to right in the image
+
+  explicit SyntheticScene(unsigned seed);
+};
+
+// Advances the scene by one 60Hz frame and renders it into frame as kCaptureWidth x kCaptureHeight
+// CV_16UC1 with 10 bit values, the same as the camera delivers.
+void renderSyntheticFrame(SyntheticScene &scene, cv::Mat &frame);
+
+#endif
@@ -0,0 +1,87 @@
+// The SmartGaze Eye Tracker
+// Copyright (C) 2016  Tristan Hume
+// Released under GPLv2, see LICENSE file for full text
+
+#include "threadPool.h"
+
+#include <algorithm>
+#include <atomic>
+
+const int ThreadPool::kDefaultThreads;
+
+struct ThreadPool::Job {
+  const std::function<void(int)> *fn;
+  int n;
+  std::atomic<int> next;
+  std::atomic<int> done;
+  int active; // workers holding a pointer to the job, guarded by the pool mutex
+};
+
+ThreadPool::ThreadPool(int numThreads) : stopping(false) {
+  if(numThreads <= 0) numThreads = std::max(1, std::min<int>(kDefaultThreads, std::thread::hardware_concurrency()));
+  for(int i = 1; i < numThreads; ++i)
+    workers.push_back(std::thread(&ThreadPool::workerLoop, this));
+}
+
+ThreadPool::~ThreadPool() {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    stopping = true;
+  }
+  workCond.notify_all();
+  for(auto &&t : workers) t.join();
+}
+
+void ThreadPool::runItems(Job *job) {
+  int i;
+  while((i = job->next.fetch_add(1)) < job->n) {
+    (*job->fn)(i);
+    job->done.fetch_add(1);
+  }
+}
+
+void ThreadPool::workerLoop() {
+  std::unique_lock<std::mutex> lock(mutex);
+  while(true) {
+    workCond.wait(lock, [this]() { return stopping || !jobs.empty(); });
+    if(stopping) return;
+    Job *job = jobs.front();
+    job->active++;
+    lock.unlock();
+    runItems(job);
+    lock.lock();
+    // every item is claimed so nobody else needs to see it
+    auto it = std::find(jobs.begin(), jobs.end(), job);
+    if(it != jobs.end()) jobs.erase(it);
+    job->active--;
+    doneCond.notify_all();
+  }
+}
+
+void ThreadPool::parallelFor(int n, const std::function<void(int)> &fn) {
+  if(n <= 0) return;
+  if(n == 1 || workers.empty()) {
+    for(int i = 0; i < n; ++i) fn(i);
+    return;
+  }
+
+  Job job;
+  job.fn = &fn;
+  job.n = n;
+  job.next = 0;
+  job.done = 0;
+  job.active = 0;
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    jobs.push_back(&job);
+  }
+  workCond.notify_all();
+
+  runItems(&job);
+
+  std::unique_lock<std::mutex> lock(mutex);
+  auto it = std::find(jobs.begin(), jobs.end(), &job);
+  if(it != jobs.end()) jobs.erase(it);
+  // the job lives on our stack, wait for workers to stop touching it
+  doneCond.wait(lock, [&job]() { return job.done.load() == job.n && job.active == 0; });
+}
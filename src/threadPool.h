@@ -0,0 +1,45 @@
+// The SmartGaze Eye Tracker
+// Copyright (C) 2016  Tristan Hume
+// Released under GPLv2, see LICENSE file for full text
+#ifndef THREADPOOL_H__
+#define THREADPOOL_H__
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// A small set of persistent worker threads for splitting per-frame work.
+class ThreadPool {
+  struct Job;
+  std::vector<std::thread> workers;
+  std::deque<Job*> jobs;
+  std::mutex mutex;
+  std::condition_variable workCond;
+  std::condition_variable doneCond;
+  bool stopping;
+
+  void workerLoop();
+  static void runItems(Job *job);
+public:
+  // Per frame work is only two eyes with a few pupil candidates each, more threads than that
+  // just wait, and other stages or batch workers may want the remaining cores.
+  static const int kDefaultThreads = 4;
+
+  // numThreads counts the calling thread, so 1 means no workers. 0 uses kDefaultThreads,
+  // or fewer on machines with fewer cores.
+  explicit ThreadPool(int numThreads = 0);
+  ~ThreadPool();
+  ThreadPool(const ThreadPool&) = delete;
+  ThreadPool &operator=(const ThreadPool&) = delete;
+
+  // Runs fn(i) for every i in [0,n) and returns once they have all finished.
+  // The calling thread works through items too, which makes it safe to call
+  // from inside a task without deadlocking when every worker is busy.
+  void parallelFor(int n, const std::function<void(int)> &fn);
+  int numThreads() const { return workers.size()+1; }
+};
+
+#endif
@@ -0,0 +1,35 @@
+// The SmartGaze Eye Tracker
+// Copyright (C) 2016  Tristan Hume
+// Released under GPLv2, see LICENSE file for full text
+#ifndef TRACKINGRESULT_H__
+#define TRACKINGRESULT_H__
+
+#include <stdint.h>
+
+// Everything tracking learned from one frame. Plain fixed size data with no pointers so it can be
+// copied into shared memory or onto a socket as is. Positions are in full resolution frame pixels.
+
+static const int kMaxTrackedEyes = 2;
+// bumped whenever the layout below changes, so clients reading raw results can tell
+static const uint32_t kTrackingResultVersion = 2;
+
+struct EyeResult {
+  float glintX, glintY; // between the eye's two glints
+  // pupil ellipse, all 0 when no pupil was found
+  float pupilX, pupilY;
+  float pupilWidth, pupilHeight; // full axis lengths
+  float pupilAngle;              // degrees, like cv::RotatedRect
+  float confidence;              // 0 to 1
+};
+
+struct TrackingResult {
+  uint64_t sequence;     // the frame's sequence number from its source
+  int64_t captureTimeUs; // the frame's capture timestamp
+  // monotonicUs() when the frame was captured and when tracking finished, 0 if unknown
+  int64_t capturedUs, resultUs;
+  uint32_t numEyes;      // eyes[0..numEyes) are valid, ordered left to right in the image
+  uint32_t reserved;
+  EyeResult eyes[kMaxTrackedEyes];
+};
+
+#endif
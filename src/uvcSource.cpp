@@ -0,0 +1,185 @@
+// The SmartGaze Eye Tracker
+// Copyright (C) 2016  Tristan Hume
+// Released under GPLv2, see LICENSE file for full text
+
+#include "frameSource.h"
+
+#include <libuvc/libuvc.h>
+#include <stdio.h>
+#include <unistd.h>
+
+static const uint8_t kCurveData[8] = {250, 0, 240, 0, 250, 0, 240, 0};
+static const int kDefaultGain = 30;
+// a libuvc capture time further back than this is taken to be wrong
+static const int64_t kMaxCaptureAgeUs = 1000000;
+
+static void setLights(uvc_device_handle_t *devh, int lights) {
+  uvc_set_ctrl(devh, 3, 3, (void*)(&lights), 2);
+}
+
+static void setupParams(uvc_device_handle_t *devh) {
+  uvc_set_ctrl(devh, 3, 4, (void*)(kCurveData), 8);
+}
+
+// How far the realtime clock is ahead of monotonicUs(), read between two monotonic samples
+// so that being preempted in the middle costs at most half the gap.
+static int64_t realtimeOffsetUs() {
+  int64_t before = monotonicUs();
+  int64_t realtime = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+  int64_t after = monotonicUs();
+  return realtime - (before + after)/2;
+}
+
+class UVCSource : public FrameSource {
+  uvc_context_t *ctx = nullptr;
+  uvc_device_t *dev = nullptr;
+  uvc_device_handle_t *devh = nullptr;
+  bool streaming = false;
+  FrameCallback callback = nullptr;
+  void *callbackData = nullptr;
+  int64_t clockOffsetUs = 0; // realtimeOffsetUs() when streaming started
+
+  /* This callback function runs once per frame. Use it to perform any
+   * quick processing you need, or have it put the frame into your application's
+   * input queue. If this function takes too long, you'll start losing frames. */
+  static void cb(uvc_frame_t *frame, void *data) {
+    UVCSource *self = (UVCSource*)(data);
+    Frame f;
+    f.data = (uint16_t*)(frame->data);
+    f.width = frame->width;
+    f.height = frame->height;
+    f.timestampUs = (int64_t)(frame->capture_time.tv_sec)*1000000 + frame->capture_time.tv_usec;
+    f.sequence = frame->sequence;
+    // libuvc stamps frames with gettimeofday() when their last packet lands, which includes the
+    // USB transfer. Moved onto the monotonic clock with the offset from stream start. Some libuvc
+    // versions leave the stamp at 0, and the wall clock may have been stepped since, so a stamp
+    // that isn't within the last second falls back to now, which only misses the USB transfer.
+    int64_t now = monotonicUs();
+    int64_t captured = f.timestampUs - self->clockOffsetUs;
+    f.capturedUs = (frame->capture_time.tv_sec != 0 && captured <= now && captured > now - kMaxCaptureAgeUs) ? captured : now;
+    self->callback(f, self->callbackData);
+  }
+
+public:
+  bool open() {
+    uvc_error_t res;
+    /* Initialize a UVC service context. Libuvc will set up its own libusb
+     * context. Replace NULL with a libusb_context pointer to run libuvc
+     * from an existing libusb context. */
+    res = uvc_init(&ctx, NULL);
+    if (res < 0) {
+      uvc_perror(res, "uvc_init");
+      ctx = nullptr;
+      return false;
+    }
+    puts("UVC initialized");
+    /* Locates the first attached UVC device, stores in dev */
+    res = uvc_find_device(
+        ctx, &dev,
+        10667, 251, NULL); /* filter devices: vendor_id, product_id, "serial_num" */
+    if (res < 0) {
+      uvc_perror(res, "uvc_find_device"); /* no devices found */
+      dev = nullptr;
+      return false;
+    }
+    puts("Device found");
+    /* Try to open the device: requires exclusive access */
+    res = uvc_open(dev, &devh);
+    if (res < 0) {
+      uvc_perror(res, "uvc_open"); /* unable to open device */
+      devh = nullptr;
+      return false;
+    }
+    puts("Device opened");
+    /* Print out a message containing all the information that libuvc
+     * knows about the device */
+    uvc_print_diag(devh, stderr);
+    return true;
+  }
+
+  bool start(FrameCallback cb, void *userData) override {
+    uvc_stream_ctrl_t ctrl;
+    /* Try to negotiate a YUYV stream profile */
+    uvc_error_t res = uvc_get_stream_ctrl_format_size(
+        devh, &ctrl, /* result stored in ctrl */
+        UVC_FRAME_FORMAT_YUYV, /* YUV 422, aka YUV 4:2:2. try _COMPRESSED */
+        kCaptureWidth, kCaptureHeight, kCaptureFPS /* width, height, fps */
+    );
+    /* Print out the result */
+    uvc_print_stream_ctrl(&ctrl, stderr);
+    if (res < 0) {
+      uvc_perror(res, "get_mode"); /* device doesn't provide a matching stream */
+      return false;
+    }
+    setLights(devh, 0b1111);
+    uvc_set_gain(devh, kDefaultGain);
+    setupParams(devh);
+    callback = cb;
+    callbackData = userData;
+    clockOffsetUs = realtimeOffsetUs();
+    /* Start the video stream. The library will call cb with this source as the user pointer */
+    res = uvc_start_streaming(devh, &ctrl, UVCSource::cb, (void*)(this), 0);
+    if (res < 0) {
+      uvc_perror(res, "start_streaming"); /* unable to start stream */
+      return false;
+    }
+    streaming = true;
+    puts("Streaming...");
+    // uvc_set_ae_mode(devh, 1); /* e.g., turn on auto exposure */
+    return true;
+  }
+
+  void stop() override {
+    if(!streaming) return;
+    setLights(devh, 0);
+    sleep(1);
+    /* End the stream. Blocks until last callback is serviced */
+    uvc_stop_streaming(devh);
+    streaming = false;
+    puts("Done streaming.");
+  }
+
+  void handleKey(char key) override {
+    if(key == 'o') {
+      setLights(devh, 0);
+    } else if(key == 'p') {
+      setupParams(devh);
+    } else if(key == 'g') {
+      uvc_set_gain(devh, 0);
+    } else if(key == 'G') {
+      uvc_set_gain(devh, 51);
+    } else if(key == 'e') {
+      uint32_t exposure;
+      uvc_get_exposure_abs(devh, &exposure, UVC_GET_CUR);
+      printf("Exposure: %i\n", exposure);
+    } else if(key == 'E') {
+      uvc_set_exposure_abs(devh, 160);
+    }
+  }
+
+  ~UVCSource() {
+    stop();
+    if(devh) {
+      /* Release our handle on the device */
+      uvc_close(devh);
+      puts("Device closed");
+    }
+    /* Release the device descriptor */
+    if(dev) uvc_unref_device(dev);
+    if(ctx) {
+      /* Close the UVC context. This closes and cleans up any existing device handles,
+       * and it closes the libusb context if one was not provided. */
+      uvc_exit(ctx);
+      puts("UVC exited");
+    }
+  }
+};
+
+FrameSource *createUVCSource() {
+  UVCSource *source = new UVCSource();
+  if(!source->open()) {
+    delete source;
+    return nullptr;
+  }
+  return source;
+}